@@ -0,0 +1,157 @@
+#include <list>
+#include <queue>
+#include <vector>
+#include <limits>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "common.hpp"
+#include "lognum.hpp"
+#include "data.hpp"
+#include "scores.hpp"
+#include "bestdagdp.hpp"
+
+#ifndef ASTAR_HPP
+#define ASTAR_HPP
+
+struct AStarStats
+{
+	uint64_t expanded;	// subsets taken off the open list
+	uint64_t generated; // subsets pushed to the open list
+	uint64_t pruned;	// successors dropped by the upper bound
+	uint64_t maxOpen;	// largest size of the open list
+};
+
+/**
+ * Exact search over the order graph with A*. A subset S is reached from
+ * S \ {i} at cost -log score(i, best parents in S \ {i}), so a shortest path
+ * from the empty set to the full set is an optimal order. The heuristic sums
+ * -log of the best unconstrained parent set score of each node outside S;
+ * it is consistent, so each subset is expanded at most once. A greedy order
+ * gives an upper bound below which successors are kept.
+ *
+ * The open list holds only (f, subset) pairs, stale ones are skipped when
+ * popped. The closed set is a hash map keyed by the subset bitmask that also
+ * holds the best g and the last node of each reached subset for
+ * backtracking. Finds an order of the same score as findBestDAG, though
+ * ties may be broken differently.
+ */
+void findBestDAGAStar(const SparseBestParents &bestPa, int n, list<int> &order, AStarStats *stats = NULL)
+{
+	if (n >= 64)
+		throw Exception("A* search supports at most 63 variables, the data has %d") % n;
+	uint64_t all = ((uint64_t)1 << n) - 1;
+	std::vector<double> hNode(n);
+	for (int i = 0; i < n; ++i)
+		hNode[i] = -log(bestPa.getScore(i, all & ~((uint64_t)1 << i)));
+
+	// upper bound from a greedy order: always add the node with the smallest cost
+	double upper = 0;
+	{
+		uint64_t ss = 0;
+		for (int l = 0; l < n; ++l)
+		{
+			double best = std::numeric_limits<double>::infinity();
+			int bestNode = -1;
+			for (int i = 0; i < n; ++i)
+			{
+				if (ss & ((uint64_t)1 << i))
+					continue;
+				double cost = -log(bestPa.getScore(i, ss));
+				if (bestNode < 0 || cost - hNode[i] < best)
+				{
+					best = cost - hNode[i];
+					bestNode = i;
+				}
+			}
+			upper += -log(bestPa.getScore(bestNode, ss));
+			ss |= (uint64_t)1 << bestNode;
+		}
+	}
+	// slack against rounding in the sums of f
+	upper += 1e-9 * (1 + std::abs(upper));
+
+	struct Reached
+	{
+		double g;
+		int last;
+		bool closed;
+	};
+	typedef std::pair<double, uint64_t> OpenEntry;
+	std::priority_queue<OpenEntry, std::vector<OpenEntry>, std::greater<OpenEntry> > open;
+	std::unordered_map<uint64_t, Reached> reached;
+	AStarStats st = {0, 0, 0, 0};
+
+	double h0 = 0;
+	for (int i = 0; i < n; ++i)
+		h0 += hNode[i];
+	Reached start = {0.0, -1, false};
+	reached[0] = start;
+	open.push(OpenEntry(h0, 0));
+	st.generated = 1;
+	while (!open.empty())
+	{
+		uint64_t ss = open.top().second;
+		open.pop();
+		Reached &cur = reached[ss];
+		if (cur.closed)
+			continue;
+		cur.closed = true;
+		++st.expanded;
+		if (ss == all)
+			break;
+		double g = cur.g;
+		double h = 0;
+		for (int i = 0; i < n; ++i)
+			if (!(ss & ((uint64_t)1 << i)))
+				h += hNode[i];
+		for (int i = 0; i < n; ++i)
+		{
+			uint64_t bit = (uint64_t)1 << i;
+			if (ss & bit)
+				continue;
+			uint64_t next = ss | bit;
+			double nextG = g - log(bestPa.getScore(i, ss));
+			double f = nextG + (h - hNode[i]);
+			if (f > upper)
+			{
+				++st.pruned;
+				continue;
+			}
+			std::unordered_map<uint64_t, Reached>::iterator it = reached.find(next);
+			if (it != reached.end() && (it->second.closed || it->second.g <= nextG))
+				continue;
+			Reached r = {nextG, i, false};
+			reached[next] = r;
+			open.push(OpenEntry(f, next));
+			++st.generated;
+		}
+		if (open.size() > st.maxOpen)
+			st.maxOpen = open.size();
+	}
+
+	uint64_t ss = all;
+	for (int l = n; l > 0; --l)
+	{
+		int i = reached[ss].last;
+		order.push_front(i);
+		ss &= ~((uint64_t)1 << i);
+	}
+	if (stats)
+		*stats = st;
+}
+
+void findBestDAGAStar(const DataView &data, int maxParents, const ScoreFun *scoreFun, list<int> &order,
+					  AStarStats *stats = NULL)
+{
+	int n = data.getNumVariables();
+	// before the scores of all parent sets are computed
+	if (n >= 64)
+		throw Exception("A* search supports at most 63 variables, the data has %d") % n;
+	SparseParentsetMap<Real> scores(n, maxParents);
+	computeScores(data, scoreFun, scores);
+	SparseBestParents bestPa(scores);
+	findBestDAGAStar(bestPa, n, order, stats);
+}
+
+#endif
@@ -0,0 +1,510 @@
+// Microbenchmarks for the counting, scoring and exact DP hot paths, the
+// log-add policies of Lognum, and repeated queries against a Session.
+//
+// Every benchmark prints one JSON object per line:
+//   {"name": ..., "params": {...}, "iterations": ..., "ns_per_op": ...,
+//    "ops_per_sec": ..., "items_per_sec": ..., "allocs_per_op": ..., "bytes_per_op": ...}
+// where items are the natural unit of work of the benchmark (samples for
+// counting, table cells for scoring, parent sets or subsets for the DP).
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "common.hpp"
+#include "lognum.hpp"
+#include "data.hpp"
+#include "adtree.hpp"
+#include "stacksubset.hpp"
+#include "scores.hpp"
+#include "scorecache.hpp"
+#include "bestdagdp.hpp"
+#include "order.hpp"
+#include "blockdp.hpp"
+#include "session.hpp"
+#include <boost/program_options.hpp>
+using namespace std;
+namespace opts = boost::program_options;
+
+// allocation accounting
+static std::atomic<size_t> nAllocs(0);
+static std::atomic<size_t> nAllocBytes(0);
+
+void *operator new(size_t size)
+{
+	++nAllocs;
+	nAllocBytes += size;
+	void *p = malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	free(p);
+}
+
+// keeps results alive so that the benchmarked work is not optimized away
+static volatile double sink;
+
+struct BenchConfig
+{
+	double minTime;
+	string filter;
+};
+
+/**
+ * Runs op in batches of doubling size until minTime seconds have passed
+ * and prints the result as a JSON line. op returns a value to sink.
+ */
+template <class Op>
+void runBench(const BenchConfig &config, const string &name, const string &params, double itemsPerOp, Op op)
+{
+	if (!config.filter.empty() && name.find(config.filter) == string::npos)
+		return;
+	sink = op(); // warm up caches and lazily built state
+	size_t iterations = 0;
+	size_t batch = 1;
+	double elapsed = 0;
+	size_t allocs0 = nAllocs, bytes0 = nAllocBytes;
+	while (elapsed < config.minTime)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		double acc = 0;
+		for (size_t i = 0; i < batch; ++i)
+			acc += op();
+		sink = acc;
+		elapsed += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		iterations += batch;
+		batch *= 2;
+	}
+	double allocs = (double)(nAllocs - allocs0) / iterations;
+	double bytes = (double)(nAllocBytes - bytes0) / iterations;
+	double nsPerOp = elapsed * 1e9 / iterations;
+	cout << format("{\"name\": \"%s\", \"params\": {%s}, \"iterations\": %d, \"ns_per_op\": %.1f, "
+				   "\"ops_per_sec\": %.1f, \"items_per_sec\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}") %
+				name % params % iterations % nsPerOp % (iterations / elapsed) % (iterations * itemsPerOp / elapsed) % allocs % bytes
+		 << endl;
+}
+
+// uniformly random data with the given arity for every variable
+void makeData(Data &data, int nVariables, int nSamples, int arity)
+{
+	ostringstream out;
+	for (int i = 0; i < nSamples; ++i)
+	{
+		for (int v = 0; v < nVariables; ++v)
+			out << (i < arity ? i : randuint(arity)) << ' ';
+		out << '\n';
+	}
+	istringstream in(out.str());
+	data.read(in, nVariables, nSamples);
+}
+
+void benchCounting(const BenchConfig &config, int nSamples)
+{
+	int arities[] = {2, 3, 4};
+	for (int a = 0; a < 3; ++a)
+	{
+		Data data;
+		makeData(data, 8, nSamples, arities[a]);
+		DataColumns columns(data);
+		ADTree adTree(columns);
+		for (int setSize = 1; setSize <= 5; ++setSize)
+		{
+			vector<int> vars;
+			for (int i = 0; i < setSize; ++i)
+				vars.push_back((3 * i + 1) % 8);
+			string p = str(format("\"set_size\": %d, \"arity\": %d, \"samples\": %d") % setSize % arities[a] % nSamples);
+			data.countKernel = COUNT_SCALAR;
+			int *expected = data.getCounts(vars);
+			for (int k = 0; k < N_COUNT_KERNELS; ++k)
+			{
+				data.countKernel = (CountKernel)k;
+				if (!isCountKernelSupported(data.countKernel))
+					continue;
+				int *counts = data.getCounts(vars);
+				int nValues = 1;
+				for (int i = 0; i < setSize; ++i)
+					nValues *= arities[a];
+				for (int c = 0; c < nValues; ++c)
+					if (counts[c] != expected[c])
+					{
+						cerr << "getCounts/" << COUNT_KERNEL_NAMES[k] << " differs from the scalar counts" << endl;
+						exit(1);
+					}
+				delete[] counts;
+				runBench(config, string("getCounts/Data/") + COUNT_KERNEL_NAMES[k], p, nSamples, [&]() {
+					int *counts = data.getCounts(vars);
+					double x = counts[0];
+					delete[] counts;
+					return x;
+				});
+			}
+			delete[] expected;
+			data.countKernel = bestCountKernel();
+			runBench(config, "getCounts/ADTree", p, nSamples, [&]() {
+				int *counts = adTree.getCounts(vars);
+				double x = counts[0];
+				delete[] counts;
+				return x;
+			});
+		}
+	}
+}
+
+void benchScoreFuns(const BenchConfig &config, int nSamples)
+{
+	Data data;
+	makeData(data, 4, nSamples, 3);
+	vector<int> vars;
+	vars.push_back(0);
+	vars.push_back(1);
+	vars.push_back(2);
+	vars.push_back(3);
+	int *counts = data.getCounts(vars);
+	int nValues = 3, nParentValues = 27;
+
+	vector<pair<string, ScoreFun *> > scoreFuns;
+	scoreFuns.push_back(make_pair(string("BDeu"), (ScoreFun *)new BDeuScore(1.0)));
+	scoreFuns.push_back(make_pair(string("BDeuCached"), (ScoreFun *)new BDeuScoreCached(1.0, nSamples, nValues * nParentValues)));
+	scoreFuns.push_back(make_pair(string("K2"), (ScoreFun *)new K2Score()));
+	scoreFuns.push_back(make_pair(string("K2Cached"), (ScoreFun *)new K2ScoreCached(nSamples + nValues)));
+	scoreFuns.push_back(make_pair(string("LL"), (ScoreFun *)new LLScore()));
+	scoreFuns.push_back(make_pair(string("MDL"), (ScoreFun *)new MDLScore(nSamples)));
+	scoreFuns.push_back(make_pair(string("AIC"), (ScoreFun *)new AICScore()));
+	for (size_t s = 0; s < scoreFuns.size(); ++s)
+	{
+		const ScoreFun *scoreFun = scoreFuns[s].second;
+		string p = str(format("\"score\": \"%s\", \"cells\": %d") % scoreFuns[s].first % (nValues * nParentValues));
+		runBench(config, "ScoreFun::compute", p, nValues * nParentValues, [&]() {
+			return scoreFun->compute(nValues, nParentValues, counts);
+		});
+	}
+
+	BDeuScore bdeu(1.0);
+	StackSubset parents(4);
+	for (int size = 0; size <= 3; ++size)
+	{
+		if (size > 0)
+			parents.push(size);
+		string p = str(format("\"parents\": %d, \"samples\": %d") % size % nSamples);
+		runBench(config, "computeScore", p, nSamples, [&]() {
+			return computeScore(&data, parents, 0, &bdeu);
+		});
+	}
+	for (size_t s = 0; s < scoreFuns.size(); ++s)
+		delete scoreFuns[s].second;
+	delete[] counts;
+}
+
+void benchOrderScoring(const BenchConfig &config, int nSamples)
+{
+	int sizes[] = {10, 20, 30};
+	BDeuScore bdeu(1.0);
+	for (int s = 0; s < 3; ++s)
+	{
+		int n = sizes[s];
+		Data data;
+		makeData(data, n, nSamples, 3);
+		DataColumns columns(data);
+		vector<int> order;
+		for (int i = 0; i < n; ++i)
+			order.push_back(i);
+		for (int k = 1; k <= 3; ++k)
+		{
+			string p = str(format("\"n\": %d, \"max_parents\": %d, \"samples\": %d") % n % k % nSamples);
+			LocalScoreCache warm(columns, &bdeu, k);
+			double nSets = 0;
+			for (int i = 0; i < n; ++i)
+				for (int j = 0; j <= k && j <= i; ++j)
+					nSets += warm.getRanker().binom(i, j);
+			runBench(config, "compute/warm", p, nSets, [&]() {
+				return compute(warm, order, k);
+			});
+			runBench(config, "order2dag/warm", p, nSets, [&]() {
+				BitMatrix dag(n);
+				order2dag(warm, order, k, dag);
+				return (double)dag(0, n - 1);
+			});
+			if (n <= 20)
+			{
+				runBench(config, "compute/cold", p, nSets, [&]() {
+					LocalScoreCache cold(columns, &bdeu, k);
+					return compute(cold, order, k);
+				});
+				runBench(config, "fill/cold", p, (double)n * warm.getNumParentsets(), [&]() {
+					LocalScoreCache cold(columns, &bdeu, k);
+					cold.fill();
+					return cold(StackSubset(n), 0);
+				});
+			}
+		}
+	}
+}
+
+void benchBestDAG(const BenchConfig &config, int nSamples)
+{
+	BDeuScore bdeu(1.0);
+	Data data;
+	makeData(data, 16, nSamples, 3);
+	for (int n = 6; n <= 14; n += 2)
+	{
+		vector<int> vars;
+		for (int i = 0; i < n; ++i)
+			vars.push_back(i);
+		DataColumns columns(data, vars);
+		int k = 3;
+		ParentsetMap<Real> scores(n);
+		ParentsetMap<size_t> bestPa(n);
+		computeScores(columns, k, &bdeu, scores);
+		findBestParents(n, scores, bestPa);
+		double nEntries = (double)n * ((size_t)1 << n);
+		string p = str(format("\"n\": %d, \"max_parents\": %d, \"samples\": %d") % n % k % nSamples);
+		if (n <= 10)
+		{
+			runBench(config, "findBestDAG/computeScores", p, nEntries, [&]() {
+				computeScores(columns, k, &bdeu, scores);
+				return (double)log(scores(0, 0));
+			});
+		}
+		runBench(config, "findBestDAG/findBestParents", p, nEntries, [&]() {
+			findBestParents(n, scores, bestPa);
+			return (double)bestPa(0, ((size_t)1 << n) - 2);
+		});
+		runBench(config, "findBestDAG/findOrder", p, (double)((size_t)1 << n), [&]() {
+			list<int> order;
+			findOrder(n, scores, bestPa, order);
+			return (double)order.front();
+		});
+
+		ParentsetMap<float> floatScores(n);
+		ParentsetMap<double> doubleScores(n);
+		ParentsetMap<uint32_t> compactBestPa(n);
+		computeLogScores(columns, k, &bdeu, floatScores);
+		computeLogScores(columns, k, &bdeu, doubleScores);
+		runBench(config, "findBestDAG/findBestParentsCompact/float", p, nEntries, [&]() {
+			findBestParentsCompact(n, floatScores, compactBestPa);
+			return (double)compactBestPa(0, ((size_t)1 << n) - 2);
+		});
+		runBench(config, "findBestDAG/findBestParentsCompact/double", p, nEntries, [&]() {
+			findBestParentsCompact(n, doubleScores, compactBestPa);
+			return (double)compactBestPa(0, ((size_t)1 << n) - 2);
+		});
+		runBench(config, "findBestDAG/findOrderCompact/double", p, (double)((size_t)1 << n), [&]() {
+			list<int> order;
+			findOrder(n, doubleScores, compactBestPa, order);
+			return (double)order.front();
+		});
+
+		SparseParentsetMap<Real> sparseScores(n, k);
+		computeScores(columns, &bdeu, sparseScores);
+		runBench(config, "findBestDAG/sparseBestParents", p, (double)n * sparseScores.getNumParentsets(), [&]() {
+			SparseBestParents sparseBestPa(sparseScores);
+			return (double)sparseBestPa(0, 0);
+		});
+		SparseBestParents sparseBestPa(sparseScores);
+		runBench(config, "findBestDAG/sparseFindOrder", p, (double)((size_t)1 << n), [&]() {
+			list<int> order;
+			findOrder(n, sparseBestPa, order);
+			return (double)order.front();
+		});
+	}
+}
+
+void benchBlockDP(const BenchConfig &config, int nSamples)
+{
+	int n = 30, k = 3;
+	BDeuScore bdeu(1.0);
+	Data data;
+	makeData(data, n, nSamples, 3);
+	DataColumns columns(data);
+	LocalScoreCache localScores(columns, &bdeu, k);
+	localScores.fill();
+	for (int swapN = 6; swapN <= 12; swapN += 2)
+	{
+		// blocks of evenly spread nodes, none of which repeats within a run
+		vector<int> targets;
+		for (int i = 0; i < swapN; ++i)
+			targets.push_back(i * n / swapN);
+		string p = str(format("\"n\": %d, \"swap_n\": %d, \"max_parents\": %d, \"samples\": %d") % n % swapN % k % nSamples);
+		if (swapN <= 8)
+		{
+			runBench(config, "blockDP/findPartialOrder", p, (double)((size_t)1 << swapN), [&]() {
+				vector<int> order;
+				findPartialOrder(data, targets, order, &bdeu, k);
+				return (double)order[0];
+			});
+		}
+		BlockDP blockDP(localScores, k, 0);
+		runBench(config, "blockDP/findBestOrder", p, (double)((size_t)1 << swapN), [&]() {
+			vector<int> order;
+			blockDP.findBestOrder(targets, order);
+			return (double)order[0];
+		});
+		BlockDP memoized(localScores, k, 1);
+		runBench(config, "blockDP/findBestOrder/memo", p, 1, [&]() {
+			vector<int> order;
+			memoized.findBestOrder(targets, order);
+			return (double)order[0];
+		});
+	}
+}
+
+// log-space sums and differences with the exact and the interpolated log-add policies
+template <class LogAdd>
+void benchLogAddPolicy(const BenchConfig &config, const string &name, const vector<double> &logs, const vector<double> &exact)
+{
+	size_t n = logs.size();
+	double maxSumError = 0, maxDifferenceError = 0;
+	for (size_t i = 0; i + 1 < n; ++i)
+	{
+		Lognum<double, LogAdd> a, b, c;
+		a.setLog(logs[i]);
+		b.setLog(logs[i + 1]);
+		c.setLog(std::max(logs[i], logs[i + 1]) + 1.5);
+		maxSumError = std::max(maxSumError, fabs(log(a + b) - exact[2 * i]));
+		maxDifferenceError = std::max(maxDifferenceError, fabs(log(c - b) - exact[2 * i + 1]));
+	}
+	string p = str(format("\"terms\": %d, \"max_abs_error\": %.3g") % n % maxSumError);
+	runBench(config, "logAdd/sum/" + name, p, (double)n, [&]() {
+		Lognum<double, LogAdd> sum;
+		for (size_t i = 0; i < n; ++i)
+		{
+			Lognum<double, LogAdd> x;
+			x.setLog(logs[i]);
+			sum += x;
+		}
+		return log(sum);
+	});
+	p = str(format("\"terms\": %d, \"max_abs_error\": %.3g") % n % maxDifferenceError);
+	runBench(config, "logAdd/difference/" + name, p, (double)n, [&]() {
+		double acc = 0;
+		for (size_t i = 0; i + 1 < n; ++i)
+		{
+			Lognum<double, LogAdd> c, b;
+			c.setLog(std::max(logs[i], logs[i + 1]) + 1.5);
+			b.setLog(logs[i + 1]);
+			acc += log(c - b);
+		}
+		return acc;
+	});
+}
+
+void benchLogAdd(const BenchConfig &config)
+{
+	// log scores spread like those of the parent sets of a node
+	size_t n = 4096;
+	vector<double> logs(n), exact(2 * n);
+	for (size_t i = 0; i < n; ++i)
+		logs[i] = -5000 - 40 * randu();
+	// log(e^a + e^b) and log(e^c - e^b) with c = max(a, b) + 1.5 of neighbours a, b in long double
+	for (size_t i = 0; i + 1 < n; ++i)
+	{
+		long double a = logs[i], b = logs[i + 1], hi = std::max(a, b), lo = std::min(a, b);
+		exact[2 * i] = (double)(hi + log1pl(expl(lo - hi)));
+		exact[2 * i + 1] = (double)(hi + 1.5L + log1pl(-expl(b - hi - 1.5L)));
+	}
+	benchLogAddPolicy<ExactLogAdd>(config, "exact", logs, exact);
+	benchLogAddPolicy<FastLogAdd>(config, "fast", logs, exact);
+}
+
+// a query mix against a new session per query (cold) and against one long-lived session (warm)
+void benchSession(const BenchConfig &config, int nSamples)
+{
+	int n = 12, k = 3;
+	ostringstream out;
+	for (int i = 0; i < nSamples; ++i)
+	{
+		for (int v = 0; v < n; ++v)
+			out << (i < 3 ? i : randuint(3)) << ' ';
+		out << '\n';
+	}
+	string text = out.str();
+	MCMCOptions options;
+	options.burnIn = 200;
+	options.maxParentSize = k;
+	options.seed = 1;
+	auto query = [&](Session &session) {
+		BitMatrix dag(n);
+		vector<int> order;
+		double score = session.findBestDAG(k, dag, &order);
+		OrderMCMCResult result(n);
+		session.runOrderMCMC(options, result);
+		return score + session.order2dag(result.order, k, dag) + result.getEdgePosterior(0, 1);
+	};
+	string p = str(format("\"n\": %d, \"max_parents\": %d, \"samples\": %d, \"burn_in\": %d") % n % k % nSamples %
+				   options.burnIn);
+	runBench(config, "session/cold", p, 1, [&]() {
+		istringstream in(text);
+		Session session(in);
+		return query(session);
+	});
+	istringstream in(text);
+	Session session(in);
+	runBench(config, "session/warm", p, 1, [&]() { return query(session); });
+}
+
+int main(int argc, char **argv)
+{
+	BenchConfig config;
+	int nSamples;
+	opts::options_description desc("Options");
+	opts::variables_map vm;
+	desc.add_options()
+	("filter,f", opts::value<string>(&config.filter), "only run benchmarks whose name contains this string")
+	("min-time,t", opts::value<double>(&config.minTime)->default_value(0.2), "minimum measuring time per benchmark in seconds")
+	("samples,n", opts::value<int>(&nSamples)->default_value(5000), "number of samples in the synthetic data")
+	("help,h", "produce help message");
+	try
+	{
+		opts::store(opts::command_line_parser(argc, argv).options(desc).run(), vm);
+		opts::notify(vm);
+	}
+	catch (opts::error &err)
+	{
+		cerr << "Error:" << err.what() << endl;
+		return 1;
+	}
+	if (vm.count("help"))
+	{
+		cerr << desc << endl;
+		return 1;
+	}
+	rng.seed(1);
+	benchCounting(config, nSamples);
+	benchScoreFuns(config, nSamples);
+	benchOrderScoring(config, nSamples);
+	benchBestDAG(config, nSamples);
+	benchBlockDP(config, nSamples);
+	benchSession(config, nSamples);
+	benchLogAdd(config);
+	return 0;
+}
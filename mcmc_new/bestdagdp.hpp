@@ -1,11 +1,18 @@
 #include <list>
-//#include <algorithm>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+#include <immintrin.h>
 
 #include "stdlib.h"
 #include "common.hpp"
 #include "lognum.hpp"
 #include "data.hpp"
 #include "scores.hpp"
+#include "subsetrank.hpp"
+#include "pruning.hpp"
+#include "hugepages.hpp"
 
 #ifndef BESTDAGDP_HPP
 #define BESTDAGDP_HPP
@@ -19,26 +26,25 @@ public:
 	const int nNodes;
 
 private:
+	LargeArray<T> table_; // the rows one after the other, on huge pages if possible
 	T **data_;
 
 	ParentsetMap(const ParentsetMap &);			   // disable copying
 	ParentsetMap &operator=(const ParentsetMap &); // disable copying
 
 public:
-	ParentsetMap(int n) : nNodes(n)
+	ParentsetMap(int n) : nNodes(n), table_((size_t)n << n)
 	{
-		size_t nSubsets = 1 << n;
+		size_t nSubsets = (size_t)1 << n;
 		data_ = new T *[nNodes];
 		for (int i = 0; i < nNodes; ++i)
 		{
-			data_[i] = new T[nSubsets];
+			data_[i] = table_.get() + i * nSubsets;
 		}
 	}
 
 	~ParentsetMap()
 	{
-		for (int i = 0; i < nNodes; ++i)
-			delete[] data_[i];
 		delete[] data_;
 	}
 
@@ -78,6 +84,202 @@ public:
 			index |= (1 << subset[i]);
 		return index;
 	}
+
+	// all 2^n entries of node i, indexed by parent set mask
+	T *getRow(size_t i)
+	{
+		assert(i < (size_t)nNodes);
+		return data_[i];
+	}
+
+	const T *getRow(size_t i) const
+	{
+		assert(i < (size_t)nNodes);
+		return data_[i];
+	}
+};
+
+/**
+ * Like ParentsetMap but holds only the parent sets with at most maxParents
+ * elements, addressed by their SubsetRanker rank instead of their bit mask.
+ */
+template <class T>
+class SparseParentsetMap
+{
+public:
+	const int nNodes;
+
+private:
+	SubsetRanker ranker_;
+	LargeArray<T> table_;
+	T **data_;
+
+	SparseParentsetMap(const SparseParentsetMap &);			   // disable copying
+	SparseParentsetMap &operator=(const SparseParentsetMap &); // disable copying
+
+public:
+	SparseParentsetMap(int n, int maxParents)
+		: nNodes(n), ranker_(n, maxParents), table_((size_t)n * ranker_.getNumSubsets())
+	{
+		size_t nSubsets = ranker_.getNumSubsets();
+		data_ = new T *[nNodes];
+		for (int i = 0; i < nNodes; ++i)
+		{
+			data_[i] = table_.get() + i * nSubsets;
+		}
+	}
+
+	~SparseParentsetMap()
+	{
+		delete[] data_;
+	}
+
+	int getMaxParents() const
+	{
+		return ranker_.getMaxSize();
+	}
+
+	size_t getNumParentsets() const
+	{
+		return ranker_.getNumSubsets();
+	}
+
+	// bit mask of the parent set stored at index j
+	size_t getParentset(size_t j) const
+	{
+		return ranker_.unrankMask(j);
+	}
+
+	T &operator()(size_t i, size_t j)
+	{
+		assert(i < (size_t)nNodes);
+		assert(j < ranker_.getNumSubsets());
+		return data_[i][j];
+	}
+
+	T operator()(size_t i, size_t j) const
+	{
+		assert(i < (size_t)nNodes);
+		assert(j < ranker_.getNumSubsets());
+		return data_[i][j];
+	}
+
+	size_t getParentsetIndex(size_t mask) const
+	{
+		return ranker_.rankMask(mask);
+	}
+};
+
+/**
+ * For each node, the parent sets of a SparseParentsetMap in decreasing
+ * order of score. The best parent set within an arbitrary candidate set is
+ * the first one in this order that is a subset of the candidates. To find
+ * it without testing the sets one by one, each variable v has a bit vector
+ * over the sorted sets with the bits of the sets that do not contain v; the
+ * AND of the vectors of the variables outside the candidates marks the
+ * compatible sets, and is formed 64 sets at a time until a bit is set.
+ */
+class SparseBestParents
+{
+private:
+	struct Entry
+	{
+		Real score;
+		size_t parents;
+	};
+
+	struct ByScore
+	{
+		bool operator()(const Entry &a, const Entry &b) const
+		{
+			return a.score > b.score || (!(b.score > a.score) && a.parents < b.parents);
+		}
+	};
+
+	int nNodes_;
+	std::vector<std::vector<Entry> > sorted_;
+	// avoid_[i][w * nNodes_ + v] has bit b set if sorted_[i][64 * w + b] does not contain v
+	std::vector<std::vector<uint64_t> > avoid_;
+
+	void buildIndex(size_t i)
+	{
+		const std::vector<Entry> &entries = sorted_[i];
+		size_t nWords = (entries.size() + 63) / 64;
+		avoid_[i].assign(nWords * nNodes_, 0);
+		for (size_t k = 0; k < entries.size(); ++k)
+			for (int v = 0; v < nNodes_; ++v)
+				if (!(entries[k].parents & ((size_t)1 << v)))
+					avoid_[i][k / 64 * nNodes_ + v] |= (uint64_t)1 << (k % 64);
+	}
+
+	const Entry &find(size_t i, size_t candidates) const
+	{
+		const std::vector<Entry> &entries = sorted_[i];
+		size_t excluded = ~candidates & ~((size_t)1 << i);
+		if (nNodes_ < 64)
+			excluded &= ((size_t)1 << nNodes_) - 1;
+		const uint64_t *words = &avoid_[i][0];
+		for (size_t k = 0; k < entries.size(); k += 64, words += nNodes_)
+		{
+			uint64_t compatible = ~(uint64_t)0;
+			for (size_t e = excluded; e && compatible; e &= e - 1)
+				compatible &= words[__builtin_ctzll(e)];
+			if (compatible)
+				return entries[k + __builtin_ctzll(compatible)];
+		}
+		assert(false); // the empty set is always a candidate
+		return entries.back();
+	}
+
+public:
+	SparseBestParents(const SparseParentsetMap<Real> &scores) : nNodes_(scores.nNodes), sorted_(scores.nNodes), avoid_(scores.nNodes)
+	{
+		for (int i = 0; i < scores.nNodes; ++i)
+		{
+			for (size_t j = 0; j < scores.getNumParentsets(); ++j)
+			{
+				size_t pa = scores.getParentset(j);
+				if (pa & ((size_t)1 << i))
+					continue;
+				Entry e;
+				e.score = scores(i, j);
+				e.parents = pa;
+				sorted_[i].push_back(e);
+			}
+			std::sort(sorted_[i].begin(), sorted_[i].end(), ByScore());
+			buildIndex(i);
+		}
+	}
+
+	// takes the candidates of pruneParentSets, which are already sorted by score
+	SparseBestParents(const CandidateParentSets &candidates)
+		: nNodes_(candidates.getNumNodes()), sorted_(candidates.getNumNodes()), avoid_(candidates.getNumNodes())
+	{
+		for (int i = 0; i < candidates.getNumNodes(); ++i)
+		{
+			const std::vector<CandidateParentSets::Candidate> &c = candidates(i);
+			sorted_[i].resize(c.size());
+			for (size_t k = 0; k < c.size(); ++k)
+			{
+				Lognum<double> tmp;
+				tmp.setLog(c[k].score);
+				sorted_[i][k].score = to<Real>(tmp);
+				sorted_[i][k].parents = c[k].parents;
+			}
+			buildIndex(i);
+		}
+	}
+
+	// best parent set of node i among the subsets of candidates
+	size_t operator()(size_t i, size_t candidates) const
+	{
+		return find(i, candidates).parents;
+	}
+
+	Real getScore(size_t i, size_t candidates) const
+	{
+		return find(i, candidates).score;
+	}
 };
 
 void computeScores(const DataView &dataView, int maxParents, const ScoreFun *scoreFun, ParentsetMap<Real> &scores)
@@ -105,6 +307,158 @@ void computeScores(const DataView &dataView, int maxParents, const ScoreFun *sco
 	}
 }
 
+// the in-degree bound is that of scores
+void computeScores(const DataView &dataView, const ScoreFun *scoreFun, SparseParentsetMap<Real> &scores)
+{
+	int n = dataView.getNumVariables();
+	StackSubset parents(n);
+	for (int i = 0; i < n; ++i)
+	{
+		int node = i;
+		for (size_t j = 0; j < scores.getNumParentsets(); ++j)
+		{
+			size_t pa = scores.getParentset(j);
+			if (pa & ((size_t)1 << node))
+				continue;
+			parents.clear();
+			for (int v = 0; v < n; ++v)
+				if (pa & ((size_t)1 << v))
+					parents.push(v);
+			Lognum<double> tmp;
+			tmp.setLog(computeScore(&dataView, parents, node, scoreFun));
+			scores(i, j) = to<Real>(tmp);
+		}
+	}
+}
+
+/**
+ * Like computeScores but stores plain log-scores, e.g. as float to halve the
+ * table. Parent sets containing the node get -inf.
+ */
+template <class S>
+void computeLogScores(const DataView &dataView, int maxParents, const ScoreFun *scoreFun, ParentsetMap<S> &logScores)
+{
+	int n = dataView.getNumVariables();
+	StackSubset parents(n);
+	for (int i = 0; i < n; ++i)
+	{
+		S *row = logScores.getRow(i);
+		for (size_t pa = 0; pa < ((size_t)1 << n); ++pa)
+		{
+			parents.clear();
+			for (int j = 0; j < n; ++j)
+				if (pa & ((size_t)1 << j))
+					parents.push(j);
+			if (parents.contains(i) || parents.size() > (size_t)maxParents)
+				row[pa] = -std::numeric_limits<S>::infinity();
+			else
+				row[pa] = computeScore(&dataView, parents, i, scoreFun);
+		}
+	}
+}
+
+/*
+ * One step of the subset-max recurrence: every subset containing bit
+ * h = 2^j takes the best parent set of the subset without it if that one
+ * scores higher. Subsets come in contiguous blocks of h with and without
+ * the bit, which the vector versions process 8 (float) or 4 (double) at a
+ * time with compare and blend instead of branches.
+ */
+template <class S>
+void relaxBit(S *best, uint32_t *pa, size_t nSubsets, size_t h)
+{
+	for (size_t base = 0; base < nSubsets; base += 2 * h)
+	{
+		S *bestLo = best + base, *bestHi = best + base + h;
+		uint32_t *paLo = pa + base, *paHi = pa + base + h;
+		for (size_t t = 0; t < h; ++t)
+		{
+			bool better = bestLo[t] > bestHi[t];
+			bestHi[t] = better ? bestLo[t] : bestHi[t];
+			paHi[t] = better ? paLo[t] : paHi[t];
+		}
+	}
+}
+
+__attribute__((target("avx2"))) void relaxBitAVX2(float *best, uint32_t *pa, size_t nSubsets, size_t h)
+{
+	assert(h % 8 == 0);
+	for (size_t base = 0; base < nSubsets; base += 2 * h)
+	{
+		float *bestLo = best + base, *bestHi = best + base + h;
+		uint32_t *paLo = pa + base, *paHi = pa + base + h;
+		for (size_t t = 0; t < h; t += 8)
+		{
+			__m256 lo = _mm256_loadu_ps(bestLo + t);
+			__m256 hi = _mm256_loadu_ps(bestHi + t);
+			__m256 better = _mm256_cmp_ps(lo, hi, _CMP_GT_OQ);
+			_mm256_storeu_ps(bestHi + t, _mm256_blendv_ps(hi, lo, better));
+			__m256 pLo = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(paLo + t)));
+			__m256 pHi = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)(paHi + t)));
+			_mm256_storeu_si256((__m256i *)(paHi + t), _mm256_castps_si256(_mm256_blendv_ps(pHi, pLo, better)));
+		}
+	}
+}
+
+__attribute__((target("avx2"))) void relaxBitAVX2(double *best, uint32_t *pa, size_t nSubsets, size_t h)
+{
+	assert(h % 4 == 0);
+	const __m256i evenLanes = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	for (size_t base = 0; base < nSubsets; base += 2 * h)
+	{
+		double *bestLo = best + base, *bestHi = best + base + h;
+		uint32_t *paLo = pa + base, *paHi = pa + base + h;
+		for (size_t t = 0; t < h; t += 4)
+		{
+			__m256d lo = _mm256_loadu_pd(bestLo + t);
+			__m256d hi = _mm256_loadu_pd(bestHi + t);
+			__m256d better = _mm256_cmp_pd(lo, hi, _CMP_GT_OQ);
+			_mm256_storeu_pd(bestHi + t, _mm256_blendv_pd(hi, lo, better));
+			// narrow the 64-bit lane mask to the 32-bit indices
+			__m128 better32 = _mm256_castps256_ps128(_mm256_castsi256_ps(
+				_mm256_permutevar8x32_epi32(_mm256_castpd_si256(better), evenLanes)));
+			__m128 pLo = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(paLo + t)));
+			__m128 pHi = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)(paHi + t)));
+			_mm_storeu_si128((__m128i *)(paHi + t), _mm_castps_si128(_mm_blendv_ps(pHi, pLo, better32)));
+		}
+	}
+}
+
+/**
+ * findBestParents for plain log-scores and 32-bit parent set indices,
+ * processing one bit at a time over all subsets of a node (branch-free
+ * and vectorized where AVX2 is available). Requires n <= 32.
+ */
+template <class S>
+void findBestParentsCompact(int n, const ParentsetMap<S> &logScores, ParentsetMap<uint32_t> &bestPa)
+{
+	assert(n <= 32);
+	size_t nSubsets = (size_t)1 << n;
+	LargeArray<S> bestTable(nSubsets);
+	S *best = bestTable.get();
+	const size_t vectorWidth = 32 / sizeof(S);
+	for (int i = 0; i < n; ++i)
+	{
+		const S *row = logScores.getRow(i);
+		uint32_t *pa = bestPa.getRow(i);
+		for (size_t ppa = 0; ppa < nSubsets; ++ppa)
+		{
+			best[ppa] = row[ppa];
+			pa[ppa] = ppa;
+		}
+		for (int j = 0; j < n; ++j)
+		{
+			if (j == i)
+				continue;
+			size_t h = (size_t)1 << j;
+			if (h >= vectorWidth && cpuHasAVX2())
+				relaxBitAVX2(best, pa, nSubsets, h);
+			else
+				relaxBit(best, pa, nSubsets, h);
+		}
+	}
+}
+
 void findBestParents(int n, const ParentsetMap<Real> &scores, ParentsetMap<size_t> &bestPa)
 {
 	for (int i = 0; i < n; ++i)
@@ -127,8 +481,8 @@ void findBestParents(int n, const ParentsetMap<Real> &scores, ParentsetMap<size_
 
 void findOrder(int n, const ParentsetMap<Real> &scores, const ParentsetMap<size_t> &bestPa, list<int> &order)
 {
-	Real *bestScore = new Real[1 << n];
-	int *bestSink = new int[1 << n];
+	LargeArray<Real> bestScore((size_t)1 << n);
+	LargeArray<int> bestSink((size_t)1 << n);
 
 	// dynamic programming
 	bestScore[0] = 1;
@@ -162,20 +516,119 @@ void findOrder(int n, const ParentsetMap<Real> &scores, const ParentsetMap<size_
 		// 		printf("%d ",j);
 		// printf("\n");
 	}
+}
+
+template <class S>
+void findOrder(int n, const ParentsetMap<S> &logScores, const ParentsetMap<uint32_t> &bestPa, list<int> &order)
+{
+	LargeArray<double> bestScore((size_t)1 << n);
+	LargeArray<int> bestSink((size_t)1 << n);
+
+	// dynamic programming in log space
+	bestScore[0] = 0;
+	for (size_t ss = 1; ss < ((size_t)1 << n); ++ss)
+	{
+		double score = -std::numeric_limits<double>::infinity();
+		int sink = -1;
+		for (int i = 0; i < n; ++i)
+		{
+			size_t sss = ss & ~((size_t)1 << i);
+			if (ss == sss)
+				continue;
+			double newScore = bestScore[sss] + logScores.getRow(i)[bestPa.getRow(i)[sss]];
+			if (newScore > score)
+			{
+				score = newScore;
+				sink = i;
+			}
+		}
+		bestScore[ss] = score;
+		bestSink[ss] = sink;
+	}
+
+	// backtracking
+	size_t ss = ((size_t)1 << n) - 1;
+	while (ss) {
+		int i = bestSink[ss];
+		order.push_front(i);
+		ss &= ~((size_t)1 << i);
+	}
+}
+
+void findOrder(int n, const SparseBestParents &bestPa, list<int> &order)
+{
+	LargeArray<Real> bestScore((size_t)1 << n);
+	LargeArray<int> bestSink((size_t)1 << n);
+
+	// dynamic programming
+	bestScore[0] = 1;
+	for (size_t ss = 1; ss < ((size_t)1 << n); ++ss)
+	{
+		Real score = 0;
+		int sink = -1;
+		for (int i = 0; i < n; ++i)
+		{
+			size_t sss = ss & ~((size_t)1 << i);
+			if (ss == sss)
+				continue;
+			Real newScore = bestScore[sss] * bestPa.getScore(i, sss);
+			if (newScore > score)
+			{
+				score = newScore;
+				sink = i;
+			}
+		}
+		bestScore[ss] = score;
+		bestSink[ss] = sink;
+	}
 
-	delete[] bestScore;
-	delete[] bestSink;
+	// backtracking
+	size_t ss = ((size_t)1 << n) - 1;
+	while (ss) {
+		int i = bestSink[ss];
+		order.push_front(i);
+		ss &= ~((size_t)1 << i);
+	}
+}
+
+// exact search keeping only the parent sets with at most maxParents elements
+void findBestDAGSparse(const DataView &data, int maxParents, const ScoreFun *scoreFun, list<int> &order)
+{
+	int n = data.getNumVariables();
+	SparseParentsetMap<Real> scores(n, maxParents);
+	computeScores(data, scoreFun, scores);
+	SparseBestParents bestPa(scores);
+	findOrder(n, bestPa, order);
+}
+
+/**
+ * Dense exact search with S log-scores (float halves the score table at the
+ * cost of precision; double gives the same result as the Real tables) and
+ * 32-bit best parent indices.
+ */
+template <class S>
+void findBestDAGCompact(const DataView &data, int maxParents, const ScoreFun *scoreFun, list<int> &order)
+{
+	int n = data.getNumVariables();
+	ParentsetMap<S> logScores(n);
+	ParentsetMap<uint32_t> bestPa(n);
+	computeLogScores(data, maxParents, scoreFun, logScores);
+	findBestParentsCompact(n, logScores, bestPa);
+	findOrder(n, logScores, bestPa, order);
 }
 
 void findBestDAG(const DataView &data, int maxParents, const ScoreFun *scoreFun, list<int> &order)
 {
 
 	int n = data.getNumVariables();
-	ParentsetMap<Real> scores(n);
-	ParentsetMap<size_t> bestPa(n);
-	computeScores(data, maxParents, scoreFun, scores);
-	findBestParents(n, scores, bestPa);
-	findOrder(n, scores, bestPa, order);
+	// the dense tables hold all 2^n parent sets; switch to the sparse ones
+	// as soon as the in-degree bound makes them substantially smaller
+	if (maxParents < n - 1 && 4 * SubsetRanker(n, maxParents).getNumSubsets() < ((size_t)1 << n))
+	{
+		findBestDAGSparse(data, maxParents, scoreFun, order);
+		return;
+	}
+	findBestDAGCompact<double>(data, maxParents, scoreFun, order);
 }
 
 #endif
@@ -0,0 +1,152 @@
+#include <cassert>
+#include <vector>
+#include <stdint.h>
+
+#include "common.hpp"
+
+#ifndef BITMATRIX_HPP
+#define BITMATRIX_HPP
+
+/**
+ * Adjacency matrix of a directed graph on n nodes with one bit per edge.
+ * Bit i of row j is the edge i --> j, so a row is the parent set of a node
+ * and the transitive closure of the rows gives the ancestors. Rows are
+ * whole 64-bit words, and clearing, merging and counting go a word at a
+ * time.
+ */
+class BitMatrix
+{
+private:
+	int n_;
+	int nWords_; // per row
+	std::vector<uint64_t> bits_;
+
+public:
+	BitMatrix(int n) : n_(n), nWords_((n + 63) / 64), bits_((size_t)n * ((n + 63) / 64), 0) {}
+
+	int getNumNodes() const
+	{
+		return n_;
+	}
+
+	int getNumWords() const
+	{
+		return nWords_;
+	}
+
+	bool operator()(int i, int j) const
+	{
+		assert(0 <= i && i < n_ && 0 <= j && j < n_);
+		return (bits_[(size_t)j * nWords_ + i / 64] >> (i % 64)) & 1;
+	}
+
+	void set(int i, int j)
+	{
+		assert(0 <= i && i < n_ && 0 <= j && j < n_);
+		bits_[(size_t)j * nWords_ + i / 64] |= (uint64_t)1 << (i % 64);
+	}
+
+	void clear(int i, int j)
+	{
+		assert(0 <= i && i < n_ && 0 <= j && j < n_);
+		bits_[(size_t)j * nWords_ + i / 64] &= ~((uint64_t)1 << (i % 64));
+	}
+
+	void clearAll()
+	{
+		for (size_t w = 0; w < bits_.size(); ++w)
+			bits_[w] = 0;
+	}
+
+	// words of the parent set of node j
+	const uint64_t *getParents(int j) const
+	{
+		return &bits_[(size_t)j * nWords_];
+	}
+
+	uint64_t *getParents(int j)
+	{
+		return &bits_[(size_t)j * nWords_];
+	}
+
+	// adds the edges of other
+	void merge(const BitMatrix &other)
+	{
+		assert(other.n_ == n_);
+		for (size_t w = 0; w < bits_.size(); ++w)
+			bits_[w] |= other.bits_[w];
+	}
+
+	// number of parents of node j
+	int countParents(int j) const
+	{
+		int count = 0;
+		const uint64_t *row = getParents(j);
+		for (int w = 0; w < nWords_; ++w)
+			count += __builtin_popcountll(row[w]);
+		return count;
+	}
+
+	// number of children of node i
+	int countChildren(int i) const
+	{
+		int count = 0;
+		for (int j = 0; j < n_; ++j)
+			count += (*this)(i, j);
+		return count;
+	}
+
+	int countEdges() const
+	{
+		int count = 0;
+		for (size_t w = 0; w < bits_.size(); ++w)
+			count += __builtin_popcountll(bits_[w]);
+		return count;
+	}
+
+	/**
+	 * Replaces every row by the ancestors of its node (Warshall's algorithm
+	 * over rows: whoever has k as an ancestor also gets k's ancestors).
+	 */
+	void closeTransitively()
+	{
+		for (int k = 0; k < n_; ++k)
+		{
+			const uint64_t *rowK = getParents(k);
+			for (int j = 0; j < n_; ++j)
+			{
+				if (!(*this)(k, j))
+					continue;
+				uint64_t *rowJ = getParents(j);
+				for (int w = 0; w < nWords_; ++w)
+					rowJ[w] |= rowK[w];
+			}
+		}
+	}
+
+	// true if the graph has no directed cycle
+	bool isAcyclic() const
+	{
+		BitMatrix ancestors(*this);
+		ancestors.closeTransitively();
+		for (int j = 0; j < n_; ++j)
+			if (ancestors(j, j))
+				return false;
+		return true;
+	}
+
+	// adds one to counts(i, j) for every edge i --> j
+	void addTo(SquareMat<int> &counts) const
+	{
+		assert(counts.getNumNodes() == n_);
+		for (int j = 0; j < n_; ++j)
+		{
+			const uint64_t *row = getParents(j);
+			for (int w = 0; w < nWords_; ++w)
+				for (uint64_t bits = row[w]; bits; bits &= bits - 1)
+					counts(w * 64 + __builtin_ctzll(bits), j)++;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <vector>
+#include <map>
+#include <deque>
+#include <limits>
+#include <stdint.h>
+
+#include "common.hpp"
+#include "stacksubset.hpp"
+#include "bestdagdp.hpp"
+#include "scorecache.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#ifndef BLOCKDP_HPP
+#define BLOCKDP_HPP
+
+/**
+ * The exact DP of the block move over a few nodes of the whole network.
+ * Local scores come from the shared LocalScoreCache instead of being
+ * recomputed from the data, the tables are kept across calls and only grow,
+ * and the best order of every target set is remembered, so a set that comes
+ * up again costs one lookup. The DP is the one of findBestDAGCompact<double>
+ * and yields the same order for the same scores.
+ */
+class BlockDP
+{
+private:
+	LocalScoreCache &localScores_;
+	int maxParents_;
+	size_t memoCapacity_;
+	int capacity_; // number of nodes the tables are sized for
+
+	std::vector<double> best_; // per node and subset of the block, the best score of a parent set within it
+	std::vector<uint32_t> pa_; // scratch for relaxBit
+	std::vector<double> bestScore_;
+	std::vector<int> bestSink_;
+
+	typedef std::map<std::vector<int>, std::vector<int> > Memo;
+	Memo memo_;
+	std::deque<Memo::iterator> memoAge_; // oldest entry first
+	uint64_t nLookups_;
+	uint64_t nHits_;
+
+	BlockDP(const BlockDP &);			 // disable copying
+	BlockDP &operator=(const BlockDP &); // disable copying
+
+	void reserve(int k)
+	{
+		if (k <= capacity_)
+			return;
+		size_t nSubsets = (size_t)1 << k;
+		best_.resize(k * nSubsets);
+		pa_.resize(nSubsets);
+		bestScore_.resize(nSubsets);
+		bestSink_.resize(nSubsets);
+		capacity_ = k;
+	}
+
+	// best_ row of node i: log score of every parent set within the block, then maximized over subsets
+	void findBestParents(const std::vector<int> &targets)
+	{
+		int k = targets.size();
+		size_t nSubsets = (size_t)1 << k;
+		StackSubset parents(k);
+		for (int i = 0; i < k; ++i)
+		{
+			double *best = &best_[i * nSubsets];
+			for (size_t mask = 0; mask < nSubsets; ++mask)
+			{
+				if ((mask & ((size_t)1 << i)) || __builtin_popcountll(mask) > maxParents_)
+				{
+					best[mask] = -std::numeric_limits<double>::infinity();
+					continue;
+				}
+				parents.clear();
+				for (int j = 0; j < k; ++j)
+					if (mask & ((size_t)1 << j))
+						parents.push(targets[j]);
+				best[mask] = localScores_(parents, targets[i]);
+			}
+			for (int j = 0; j < k; ++j)
+			{
+				if (j == i)
+					continue;
+				size_t h = (size_t)1 << j;
+				if (h >= 4 && cpuHasAVX2())
+					relaxBitAVX2(best, &pa_[0], nSubsets, h);
+				else
+					relaxBit(best, &pa_[0], nSubsets, h);
+			}
+		}
+	}
+
+	// the best sink DP of findOrder over the subsets of the block, returning block positions
+	void findOrder(int k, std::vector<int> &positions)
+	{
+		size_t nSubsets = (size_t)1 << k;
+		bestScore_[0] = 0;
+		for (size_t ss = 1; ss < nSubsets; ++ss)
+		{
+			double score = -std::numeric_limits<double>::infinity();
+			int sink = -1;
+			for (int i = 0; i < k; ++i)
+			{
+				size_t sss = ss & ~((size_t)1 << i);
+				if (ss == sss)
+					continue;
+				double newScore = bestScore_[sss] + best_[i * nSubsets + sss];
+				if (newScore > score)
+				{
+					score = newScore;
+					sink = i;
+				}
+			}
+			bestScore_[ss] = score;
+			bestSink_[ss] = sink;
+		}
+		positions.resize(k);
+		size_t ss = nSubsets - 1;
+		for (int p = k - 1; p >= 0; --p)
+		{
+			int i = bestSink_[ss];
+			positions[p] = i;
+			ss &= ~((size_t)1 << i);
+		}
+	}
+
+public:
+	// memoCapacity is the number of target sets whose order is remembered, 0 disables the memo
+	BlockDP(LocalScoreCache &localScores, int maxParents, size_t memoCapacity)
+		: localScores_(localScores), maxParents_(maxParents), memoCapacity_(memoCapacity), capacity_(0), nLookups_(0),
+		  nHits_(0)
+	{
+	}
+
+	/**
+	 * Appends to order the nodes of targets, which must be sorted, in the
+	 * order of a highest scoring DAG over them.
+	 */
+	void findBestOrder(const std::vector<int> &targets, std::vector<int> &order)
+	{
+		PhaseTimer timer(PHASE_BLOCK_DP);
+		TraceSpan span("block_dp");
+		++nLookups_;
+		if (memoCapacity_ > 0)
+		{
+			Memo::const_iterator it = memo_.find(targets);
+			if (it != memo_.end())
+			{
+				++nHits_;
+				order.insert(order.end(), it->second.begin(), it->second.end());
+				return;
+			}
+		}
+		int k = targets.size();
+		if (k > 30)
+			throw Exception("Block of %d nodes is too large for the exact DP") % k;
+		reserve(k);
+		findBestParents(targets);
+		std::vector<int> positions;
+		findOrder(k, positions);
+		std::vector<int> best(k);
+		for (int p = 0; p < k; ++p)
+			best[p] = targets[positions[p]];
+		order.insert(order.end(), best.begin(), best.end());
+		if (memoCapacity_ == 0)
+			return;
+		if (memo_.size() >= memoCapacity_)
+		{
+			memo_.erase(memoAge_.front());
+			memoAge_.pop_front();
+		}
+		memoAge_.push_back(memo_.insert(std::make_pair(targets, best)).first);
+	}
+
+	uint64_t getNumLookups() const
+	{
+		return nLookups_;
+	}
+
+	uint64_t getNumHits() const
+	{
+		return nHits_;
+	}
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include "common.hpp"
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+/**
+ * Everything needed to continue an order MCMC run bit-exactly.
+ */
+struct ChainState
+{
+	int nVariables;
+	int burnIn;
+	int maxParentSize;
+	int swapN;
+	uint64_t dataHash;		 // hashData of the columns the chain runs on, 0 without a checkpoint
+	std::vector<double> moveWeights;
+	int remaining;			 // value of the iteration counter after the last finished iteration
+	int sampleCount;
+	uint64_t nSamples;		 // samples written to the sample file, 0 without one
+	double score;			 // log score of the current order
+	double elapsed;			 // CPU time spent before this checkpoint
+	std::vector<int> order;
+	std::vector<int> edgeCounts; // accumulated DAG samples, row-major n x n
+	std::string rngState;	  // textual std::mt19937 state
+};
+
+static const char CHECKPOINT_MAGIC[4] = {'B', 'N', 'C', 'K'};
+static const int CHECKPOINT_VERSION = 4;
+
+template <typename T>
+void putRaw(std::string &buf, const T &x)
+{
+	buf.append((const char *)&x, sizeof(T));
+}
+
+template <typename T>
+void getRaw(std::istream &in, T &x)
+{
+	in.read((char *)&x, sizeof(T));
+	if (!in)
+		throw Exception("Truncated checkpoint");
+}
+
+std::string serializeChainState(const ChainState &s)
+{
+	std::string buf;
+	buf.append(CHECKPOINT_MAGIC, 4);
+	putRaw(buf, CHECKPOINT_VERSION);
+	putRaw(buf, s.nVariables);
+	putRaw(buf, s.burnIn);
+	putRaw(buf, s.maxParentSize);
+	putRaw(buf, s.swapN);
+	putRaw(buf, s.dataHash);
+	int nWeights = s.moveWeights.size();
+	putRaw(buf, nWeights);
+	for (int i = 0; i < nWeights; ++i)
+		putRaw(buf, s.moveWeights[i]);
+	putRaw(buf, s.remaining);
+	putRaw(buf, s.sampleCount);
+	putRaw(buf, s.nSamples);
+	putRaw(buf, s.score);
+	putRaw(buf, s.elapsed);
+	for (size_t i = 0; i < s.order.size(); ++i)
+		putRaw(buf, s.order[i]);
+	for (size_t i = 0; i < s.edgeCounts.size(); ++i)
+		putRaw(buf, s.edgeCounts[i]);
+	int rngLen = s.rngState.size();
+	putRaw(buf, rngLen);
+	buf.append(s.rngState);
+	return buf;
+}
+
+void readChainState(const std::string &path, ChainState &s)
+{
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if (!in.is_open())
+		throw Exception("Could not open checkpoint %s") % path;
+	char magic[4];
+	in.read(magic, 4);
+	int version;
+	getRaw(in, version);
+	if (memcmp(magic, CHECKPOINT_MAGIC, 4) != 0 || version != CHECKPOINT_VERSION)
+		throw Exception("%s is not a checkpoint of this version") % path;
+	getRaw(in, s.nVariables);
+	getRaw(in, s.burnIn);
+	getRaw(in, s.maxParentSize);
+	getRaw(in, s.swapN);
+	getRaw(in, s.dataHash);
+	int nWeights;
+	getRaw(in, nWeights);
+	if (nWeights < 0 || nWeights > 64)
+		throw Exception("Corrupt checkpoint %s") % path;
+	s.moveWeights.resize(nWeights);
+	for (int i = 0; i < nWeights; ++i)
+		getRaw(in, s.moveWeights[i]);
+	getRaw(in, s.remaining);
+	getRaw(in, s.sampleCount);
+	getRaw(in, s.nSamples);
+	getRaw(in, s.score);
+	getRaw(in, s.elapsed);
+	int n = s.nVariables;
+	if (n <= 0)
+		throw Exception("Corrupt checkpoint %s") % path;
+	s.order.resize(n);
+	for (int i = 0; i < n; ++i)
+		getRaw(in, s.order[i]);
+	s.edgeCounts.resize(n * n);
+	for (int i = 0; i < n * n; ++i)
+		getRaw(in, s.edgeCounts[i]);
+	int rngLen;
+	getRaw(in, rngLen);
+	if (rngLen < 0)
+		throw Exception("Corrupt checkpoint %s") % path;
+	s.rngState.resize(rngLen);
+	in.read(&s.rngState[0], rngLen);
+	if (!in)
+		throw Exception("Truncated checkpoint");
+}
+
+/**
+ * Writes checkpoints on a background thread so that the chain never waits
+ * for the disk. Only the newest pending snapshot is kept; each one is written
+ * to a temporary file which is then renamed over the previous checkpoint,
+ * so a crash leaves either the old or the new checkpoint, never a torn one.
+ */
+class CheckpointWriter
+{
+private:
+	std::string path_;
+	std::string pending_;
+	bool hasPending_;
+	bool stop_;
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	std::thread thread_;
+
+	CheckpointWriter(const CheckpointWriter &);			   // disable copying
+	CheckpointWriter &operator=(const CheckpointWriter &); // disable copying
+
+	void writeFile(const std::string &bytes)
+	{
+		std::string tmpPath = path_ + ".tmp";
+		FILE *f = fopen(tmpPath.c_str(), "wb");
+		if (f == NULL)
+		{
+			fprintf(stderr, "checkpoint: could not open %s\n", tmpPath.c_str());
+			return;
+		}
+		bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+		ok = (fflush(f) == 0) && ok;
+		ok = (fsync(fileno(f)) == 0) && ok;
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || rename(tmpPath.c_str(), path_.c_str()) != 0)
+		{
+			fprintf(stderr, "checkpoint: could not write %s\n", path_.c_str());
+			return;
+		}
+		// the rename is only durable once the directory entry is on disk
+		size_t slash = path_.rfind('/');
+		std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path_.substr(0, slash);
+		int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+		if (dirFd < 0 || fsync(dirFd) != 0)
+			fprintf(stderr, "checkpoint: could not sync directory %s\n", dir.c_str());
+		if (dirFd >= 0)
+			close(dirFd);
+	}
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true)
+		{
+			while (!hasPending_ && !stop_)
+				cond_.wait(lock);
+			if (!hasPending_)
+				return;
+			std::string bytes;
+			bytes.swap(pending_);
+			hasPending_ = false;
+			lock.unlock();
+			writeFile(bytes);
+			lock.lock();
+		}
+	}
+
+public:
+	CheckpointWriter(const std::string &path)
+		: path_(path), hasPending_(false), stop_(false)
+	{
+		thread_ = std::thread(&CheckpointWriter::run, this);
+	}
+
+	// flushes the last submitted snapshot before returning
+	~CheckpointWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		cond_.notify_one();
+		thread_.join();
+	}
+
+	void submit(const ChainState &state)
+	{
+		std::string bytes = serializeChainState(state);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_.swap(bytes);
+			hasPending_ = true;
+		}
+		cond_.notify_one();
+	}
+};
+
+#endif
@@ -45,6 +45,17 @@ int randuint(int ceiling) {
 	return rand() % ceiling;
 }/**/
 
+// instruction sets of the running CPU, for kernels selected at run time
+bool cpuHasAVX2() {
+	static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+	return hasAVX2;
+}
+
+bool cpuHasAVX512() {
+	static const bool hasAVX512 = __builtin_cpu_supports("avx512f");
+	return hasAVX512;
+}
+
 
 using boost::format;
 using std::string;
@@ -52,6 +63,7 @@ using std::string;
 class Exception {
 private:
 	format msg_;
+	string what_;
 	
 public:
 	Exception(const string& msg) : msg_(msg) {
@@ -66,7 +78,8 @@ public:
 	}
 	
 	const char* what() {
-		return str(msg_).c_str();
+		what_ = str(msg_);
+		return what_.c_str();
 	}
 };
 
@@ -97,6 +110,7 @@ public:
 		assert(other.nNodes_ == nNodes_);
 		for (int i = 0; i < nNodes_ * nNodes_; ++i)
 			data_[i] = other.data_[i];
+		return *this;
 	}
 	
 	int getNumNodes() const {
@@ -0,0 +1,108 @@
+#include <vector>
+#include <stdint.h>
+
+#include "common.hpp"
+#include "data.hpp"
+#include "stacksubset.hpp"
+#include "scores.hpp"
+#include "metrics.hpp"
+#include "samplecodes.hpp"
+
+#ifndef COUNTLATTICE_HPP
+#define COUNTLATTICE_HPP
+
+/**
+ * Contingency tables of a node with every subset of one parent set from a
+ * single pass over the data. count() tallies the joint table of the parents
+ * and the node; the table of any subset of the parents is then the sum over
+ * the values of the other parents, which touches only the cells of the
+ * joint table. The derived tables have the layout of DataView::getCounts
+ * for the selected parents, in the given order, followed by the node, so
+ * scores computed from them are the same as those of computeScore.
+ */
+class CountLattice
+{
+private:
+	const DataView &data_;
+	std::vector<int> vars_;	   // parents, then the node
+	std::vector<int> arities_; // of vars_
+	std::vector<int> joint_;
+	std::vector<int> marginal_;
+	std::vector<int> digits_;
+	SampleCodes sampleCodes_;
+
+	CountLattice(const CountLattice &);			   // disable copying
+	CountLattice &operator=(const CountLattice &); // disable copying
+
+public:
+	CountLattice(const DataView &data) : data_(data), sampleCodes_(data) {}
+
+	// number of cells of the joint table of parents and node
+	size_t getTableSize(const StackSubset &parents, int node) const
+	{
+		size_t nCells = data_.getArity(node);
+		for (size_t i = 0; i < parents.size(); ++i)
+			nCells *= data_.getArity(parents[i]);
+		return nCells;
+	}
+
+	// tallies the joint table of parents and node in one pass over the data
+	void count(const StackSubset &parents, int node)
+	{
+		int k = parents.size();
+		vars_.resize(k + 1);
+		arities_.resize(k + 1);
+		for (int i = 0; i < k; ++i)
+			vars_[i] = parents[i];
+		vars_[k] = node;
+		for (int i = 0; i <= k; ++i)
+			arities_[i] = data_.getArity(vars_[i]);
+		PhaseTimer timer(PHASE_COUNTING);
+		int *counts = sampleCodes_.isSupported() ? sampleCodes_.getCounts(vars_) : data_.getCounts(vars_);
+		joint_.assign(counts, counts + getTableSize(parents, node));
+		delete[] counts;
+	}
+
+	/**
+	 * Table of the node and the parents whose bits are set in mask (bit i
+	 * selects the i-th parent of the last count()), valid until the next
+	 * call. nParentValues receives the number of parent configurations.
+	 */
+	int *marginalize(uint32_t mask, int &nParentValues)
+	{
+		PhaseTimer timer(PHASE_COUNTING);
+		int k = vars_.size() - 1;
+		nParentValues = 1;
+		for (int i = 0; i < k; ++i)
+			if (mask & ((uint32_t)1 << i))
+				nParentValues *= arities_[i];
+		if (mask == ((uint32_t)1 << k) - 1)
+			return &joint_[0];
+		marginal_.assign((size_t)nParentValues * arities_[k], 0);
+		digits_.assign(k + 1, 0);
+		for (size_t cell = 0; cell < joint_.size(); ++cell)
+		{
+			size_t index = 0;
+			for (int i = 0; i < k; ++i)
+				if (mask & ((uint32_t)1 << i))
+					index = index * arities_[i] + digits_[i];
+			marginal_[index * arities_[k] + digits_[k]] += joint_[cell];
+			// advance the mixed-radix digits of the joint cell, the node fastest
+			for (int i = k; i >= 0 && ++digits_[i] == arities_[i]; --i)
+				digits_[i] = 0;
+		}
+		return &marginal_[0];
+	}
+
+	// local score of the node with the parents selected by mask, see marginalize
+	double score(uint32_t mask, const ScoreFun *scoreFun)
+	{
+		metrics.countComputeScore();
+		int nParentValues;
+		int *counts = marginalize(mask, nParentValues);
+		PhaseTimer timer(PHASE_SCORING);
+		return scoreFun->compute(arities_.back(), nParentValues, counts);
+	}
+};
+
+#endif
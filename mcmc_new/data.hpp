@@ -4,6 +4,9 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <stdint.h>
+#include <immintrin.h>
 
 #include "common.hpp"
 
@@ -21,8 +24,150 @@ public:
 	virtual int getNumVariables() const = 0;
 	virtual int getArity(int i) const = 0;
 	virtual int *getCounts(const std::vector<int> &vars) const = 0;
+	// copies the value of variable v in every sample to values; views that cannot list values return false
+	virtual bool getColumn(int, std::vector<Datum> &) const
+	{
+		return false;
+	}
+};
+
+/*
+ * Histogram kernels of Data::getCounts. Samples are rows of stride bytes;
+ * each sample adds one to the cell given by the mixed-radix code of the
+ * values of vars, most significant first. The vector kernels compute the
+ * codes of 8 (AVX2) or 16 (AVX-512) samples at once from gathered values
+ * and spread the increments over nHists private tables, so that equal codes
+ * in a row do not wait on each other's stores; the tables are summed into
+ * the first one at the end. All kernels give the same counts.
+ */
+enum CountKernel
+{
+	COUNT_SCALAR,
+	COUNT_AVX2,
+	COUNT_AVX512,
+	N_COUNT_KERNELS
 };
 
+static const char *const COUNT_KERNEL_NAMES[N_COUNT_KERNELS] = {"scalar", "avx2", "avx512"};
+
+CountKernel bestCountKernel()
+{
+	if (cpuHasAVX512())
+		return COUNT_AVX512;
+	if (cpuHasAVX2())
+		return COUNT_AVX2;
+	return COUNT_SCALAR;
+}
+
+bool isCountKernelSupported(CountKernel kernel)
+{
+	return kernel == COUNT_SCALAR || (kernel == COUNT_AVX2 && cpuHasAVX2()) || (kernel == COUNT_AVX512 && cpuHasAVX512());
+}
+
+void countSamplesScalar(const Datum *data, int stride, int first, int last, const int *vars, const int *arities,
+						int nVars, int *counts)
+{
+	for (int j = first; j < last; ++j)
+	{
+		const Datum *row = data + (size_t)j * stride;
+		int index = 0;
+		for (int i = 0; i < nVars; ++i)
+			index = index * arities[i] + row[vars[i]];
+		++counts[index];
+	}
+}
+
+__attribute__((target("avx2"))) void countSamplesAVX2(const Datum *data, int stride, int first, int last,
+													  const int *vars, const int *arities, int nVars, int **hists,
+													  int nHists)
+{
+	const __m256i lowByte = _mm256_set1_epi32(0xff);
+	const __m256i step = _mm256_set1_epi32(8 * stride);
+	__m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+	offsets = _mm256_add_epi32(offsets, _mm256_set1_epi32(first * stride));
+	int codes[8] __attribute__((aligned(32)));
+	for (int j = first; j < last; j += 8)
+	{
+		__m256i index = _mm256_setzero_si256();
+		for (int i = 0; i < nVars; ++i)
+		{
+			__m256i values = _mm256_and_si256(
+				_mm256_i32gather_epi32((const int *)(data + vars[i]), offsets, 1), lowByte);
+			index = _mm256_add_epi32(_mm256_mullo_epi32(index, _mm256_set1_epi32(arities[i])), values);
+		}
+		_mm256_store_si256((__m256i *)codes, index);
+		for (int l = 0; l < 8; ++l)
+			++hists[l & (nHists - 1)][codes[l]];
+		offsets = _mm256_add_epi32(offsets, step);
+	}
+}
+
+__attribute__((target("avx512f"))) void countSamplesAVX512(const Datum *data, int stride, int first, int last,
+														   const int *vars, const int *arities, int nVars, int **hists,
+														   int nHists)
+{
+	const __m512i lowByte = _mm512_set1_epi32(0xff);
+	const __m512i step = _mm512_set1_epi32(16 * stride);
+	__m512i offsets = _mm512_mullo_epi32(
+		_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(stride));
+	offsets = _mm512_add_epi32(offsets, _mm512_set1_epi32(first * stride));
+	int codes[16] __attribute__((aligned(64)));
+	for (int j = first; j < last; j += 16)
+	{
+		__m512i index = _mm512_setzero_si512();
+		for (int i = 0; i < nVars; ++i)
+		{
+			__m512i values = _mm512_and_si512(
+				_mm512_i32gather_epi32(offsets, (const void *)(data + vars[i]), 1), lowByte);
+			index = _mm512_add_epi32(_mm512_mullo_epi32(index, _mm512_set1_epi32(arities[i])), values);
+		}
+		_mm512_store_si512((__m512i *)codes, index);
+		for (int l = 0; l < 16; ++l)
+			++hists[l & (nHists - 1)][codes[l]];
+		offsets = _mm512_add_epi32(offsets, step);
+	}
+}
+
+/**
+ * Adds the histogram of the codes of vars over nSamples rows of data to
+ * counts (nValues cells) with the given kernel. The gathers read 4 bytes
+ * per value, so the vector kernels stop where that would pass the end of
+ * the data and leave the last rows to the scalar loop.
+ */
+void countSamples(CountKernel kernel, const Datum *data, int stride, int nSamples, const int *vars,
+				  const int *arities, int nVars, int nValues, int *counts)
+{
+	int width = kernel == COUNT_AVX512 ? 16 : 8;
+	int maxVar = 0;
+	for (int i = 0; i < nVars; ++i)
+		maxVar = vars[i] > maxVar ? vars[i] : maxVar;
+	int nVector = 0;
+	size_t size = (size_t)stride * nSamples;
+	if (kernel != COUNT_SCALAR && nVars > 0 && size + width * (size_t)stride < ((size_t)1 << 31))
+	{
+		// rows j with j * stride + maxVar + 4 <= size can be gathered
+		int nSafe = nSamples - (maxVar + 4 + stride - 1) / stride + 1;
+		nVector = nSafe > 0 ? nSafe / width * width : 0;
+	}
+	if (nVector > 0)
+	{
+		// private tables only while they all stay in the L1 cache
+		int nHists = nValues <= 2048 ? 4 : 1;
+		std::vector<int> extra((size_t)(nHists - 1) * nValues, 0);
+		int *hists[4] = {counts, counts, counts, counts};
+		for (int h = 1; h < nHists; ++h)
+			hists[h] = &extra[(size_t)(h - 1) * nValues];
+		if (kernel == COUNT_AVX512)
+			countSamplesAVX512(data, stride, 0, nVector, vars, arities, nVars, hists, nHists);
+		else
+			countSamplesAVX2(data, stride, 0, nVector, vars, arities, nVars, hists, nHists);
+		for (int h = 1; h < nHists; ++h)
+			for (int c = 0; c < nValues; ++c)
+				counts[c] += hists[h][c];
+	}
+	countSamplesScalar(data, stride, nVector, nSamples, vars, arities, nVars, counts);
+}
+
 class Data : public DataView
 {
 private:
@@ -50,6 +195,7 @@ public:
 	int nSamples;
 	Datum *data;
 	int *arities;
+	CountKernel countKernel; // histogram kernel of getCounts
 
 	Data()
 	{
@@ -57,6 +203,7 @@ public:
 		nSamples = 0;
 		data = NULL;
 		arities = NULL;
+		countKernel = bestCountKernel();
 	}
 
 	void clear()
@@ -202,15 +349,21 @@ public:
 			counts[i] = 0;
 
 		// fill counts
-		for (int j = 0; j < nSamples; ++j)
-		{
-			int index = 0;
-			for (size_t i = 0; i < vars.size(); ++i)
-				index = index * getArity(vars[i]) + (*this)(vars[i], j);
-			++counts[index];
-		}
+		std::vector<int> varArities(vars.size());
+		for (size_t i = 0; i < vars.size(); ++i)
+			varArities[i] = getArity(vars[i]);
+		countSamples(countKernel, data, nVariables, nSamples, vars.empty() ? NULL : &vars[0],
+					 varArities.empty() ? NULL : &varArities[0], vars.size(), nValues, counts);
 		return counts;
 	}
+
+	bool getColumn(int v, std::vector<Datum> &values) const
+	{
+		values.resize(nSamples);
+		for (int j = 0; j < nSamples; ++j)
+			values[j] = (*this)(v, j);
+		return true;
+	}
 };
 
 class DataColumns : public DataView
@@ -260,6 +413,11 @@ public:
 			transVars[i] = variables_[vars[i]];
 		return data_.getCounts(transVars);
 	}
+
+	bool getColumn(int v, std::vector<Datum> &values) const
+	{
+		return data_.getColumn(variables_[v], values);
+	}
 }; /**/
 
 #endif
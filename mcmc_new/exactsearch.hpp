@@ -0,0 +1,103 @@
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "data.hpp"
+#include "scores.hpp"
+#include "stacksubset.hpp"
+#include "scorecache.hpp"
+#include "bestdagdp.hpp"
+#include "pruning.hpp"
+#include "layereddp.hpp"
+#include "astar.hpp"
+#include "order.hpp"
+#include "timer.hpp"
+#include "trace.hpp"
+
+#ifndef EXACTSEARCH_HPP
+#define EXACTSEARCH_HPP
+
+/**
+ * Finds an optimal DAG over targets with one of the exact engines ("dp",
+ * "layered" or "astar") and writes it to result.dat in the format of myMCMC.
+ * With prune the engines search over the candidates of pruneParentSets
+ * instead of scoring every parent set.
+ */
+void exactSearch(Data &data, vector<int> &targets, int maxParentSize, const std::string &engine, bool prune = false,
+				 const std::string &spillDir = "")
+{
+	Timer timer;
+	double equivalentSampleSize = 1;
+	int n = targets.size();
+	BDeuScore scoreFun(equivalentSampleSize);
+	DataColumns datacolumns(data, targets);
+	list<int> bestOrder;
+	timer.start();
+	CandidateParentSets candidates(n);
+	{
+		TraceSpan span("exact_search");
+		SparseBestParents *bestPa = NULL;
+		if (prune)
+		{
+			PruningStats pruningStats;
+			pruneParentSets(datacolumns, maxParentSize, &scoreFun, candidates, &pruningStats);
+			printPruningStats(cout, pruningStats);
+			bestPa = new SparseBestParents(candidates);
+		}
+		AStarStats stats;
+		if (engine == "dp")
+		{
+			if (bestPa)
+				findOrder(n, *bestPa, bestOrder);
+			else
+				findBestDAG(datacolumns, maxParentSize, &scoreFun, bestOrder);
+		}
+		else if (engine == "layered")
+		{
+			if (bestPa)
+				findBestDAGLayered(*bestPa, n, bestOrder, spillDir);
+			else
+				findBestDAGLayered(datacolumns, maxParentSize, &scoreFun, bestOrder, spillDir);
+		}
+		else if (engine == "astar")
+		{
+			if (bestPa)
+				findBestDAGAStar(*bestPa, n, bestOrder, &stats);
+			else
+				findBestDAGAStar(datacolumns, maxParentSize, &scoreFun, bestOrder, &stats);
+			cout << "subsets expanded: " << stats.expanded << " of " << ((uint64_t)1 << n)
+				 << ", generated: " << stats.generated << ", pruned: " << stats.pruned
+				 << ", largest open list: " << stats.maxOpen << endl;
+		}
+		else
+		{
+			delete bestPa;
+			throw Exception("Unknown exact search engine %s") % engine;
+		}
+		delete bestPa;
+	}
+	vector<int> order(bestOrder.begin(), bestOrder.end());
+	LocalScoreCache localScores(datacolumns, &scoreFun, maxParentSize);
+	BitMatrix dag(n);
+	if (prune)
+		order2dag(candidates, order, dag);
+	else
+		order2dag(localScores, order, maxParentSize, dag);
+	SquareMat<int> res(n);
+	res.setAll(0);
+	dag.addTo(res);
+	double score = dagLogScore(localScores, dag);
+	cout << "best order:";
+	for (int i = 0; i < n; ++i)
+		cout << " " << targets[order[i]];
+	cout << endl;
+	cout << "score: " << setprecision(10) << score << endl;
+	pageAllocator.report(cout);
+	cout << "time elapsed: " << timer.elapsed() << endl;
+	writeEdgeFrequencies("result.dat", res, 1);
+}
+
+#endif
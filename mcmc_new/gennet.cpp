@@ -0,0 +1,160 @@
+// Generates a random Bayesian network and forward-samples data from it.
+//
+// The data is written in the format read by main (one sample per row,
+// whitespace separated values) and the true graph in the format of
+// result.dat ("i --> j 1.000"), so that scoreboard can compare them.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <boost/program_options.hpp>
+using namespace std;
+namespace opts = boost::program_options;
+
+struct Network
+{
+	int nNodes;
+	vector<int> arities;
+	vector<int> order;			  // a topological order
+	vector<vector<int> > parents; // parents[v] in ascending order
+	vector<vector<double> > cpts; // cpts[v][config * arity + value]
+};
+
+void generateNetwork(Network &net, int nNodes, int maxIndegree, int minArity, int maxArity, double alpha, std::mt19937 &gen)
+{
+	net.nNodes = nNodes;
+	net.arities.resize(nNodes);
+	net.parents.assign(nNodes, vector<int>());
+	net.cpts.resize(nNodes);
+	uniform_int_distribution<> arityDist(minArity, maxArity);
+	for (int v = 0; v < nNodes; ++v)
+		net.arities[v] = arityDist(gen);
+	net.order.resize(nNodes);
+	for (int v = 0; v < nNodes; ++v)
+		net.order[v] = v;
+	shuffle(net.order.begin(), net.order.end(), gen);
+
+	for (int pos = 0; pos < nNodes; ++pos)
+	{
+		int v = net.order[pos];
+		int maxPa = min(pos, maxIndegree);
+		uniform_int_distribution<> nPaDist(0, maxPa);
+		int nPa = nPaDist(gen);
+		vector<int> candidates(net.order.begin(), net.order.begin() + pos);
+		shuffle(candidates.begin(), candidates.end(), gen);
+		net.parents[v].assign(candidates.begin(), candidates.begin() + nPa);
+		sort(net.parents[v].begin(), net.parents[v].end());
+
+		// one Dirichlet(alpha) distribution per parent configuration
+		int nConfigs = 1;
+		for (size_t i = 0; i < net.parents[v].size(); ++i)
+			nConfigs *= net.arities[net.parents[v][i]];
+		int r = net.arities[v];
+		net.cpts[v].resize(nConfigs * r);
+		gamma_distribution<double> gammaDist(alpha, 1.0);
+		for (int c = 0; c < nConfigs; ++c)
+		{
+			double sum = 0;
+			for (int k = 0; k < r; ++k)
+				sum += net.cpts[v][c * r + k] = gammaDist(gen) + 1e-300;
+			for (int k = 0; k < r; ++k)
+				net.cpts[v][c * r + k] /= sum;
+		}
+	}
+}
+
+void sampleNetwork(const Network &net, int nSamples, std::mt19937 &gen, ostream &out)
+{
+	vector<int> values(net.nNodes);
+	uniform_real_distribution<double> unif(0.0, 1.0);
+	for (int i = 0; i < nSamples; ++i)
+	{
+		for (int pos = 0; pos < net.nNodes; ++pos)
+		{
+			int v = net.order[pos];
+			int config = 0;
+			for (size_t j = 0; j < net.parents[v].size(); ++j)
+				config = config * net.arities[net.parents[v][j]] + values[net.parents[v][j]];
+			int r = net.arities[v];
+			const double *p = &net.cpts[v][config * r];
+			double u = unif(gen);
+			int k = 0;
+			while (k < r - 1 && (u -= p[k]) > 0)
+				++k;
+			values[v] = k;
+		}
+		for (int v = 0; v < net.nNodes; ++v)
+			out << values[v] << (v + 1 < net.nNodes ? " " : "\n");
+	}
+}
+
+void writeGraph(const Network &net, ostream &out)
+{
+	int n = net.nNodes;
+	vector<char> adj(n * n, 0);
+	for (int v = 0; v < n; ++v)
+		for (size_t j = 0; j < net.parents[v].size(); ++j)
+			adj[net.parents[v][j] * n + v] = 1;
+	for (int i = 0; i < n; ++i)
+		for (int j = 0; j < n; ++j)
+			out << i << " --> " << j << " " << (adj[i * n + j] ? "1.000" : "0.000") << endl;
+}
+
+int main(int argc, char **argv)
+{
+	int nNodes, maxIndegree, minArity, maxArity, nSamples;
+	unsigned int seed;
+	double alpha;
+	string dataFile, graphFile;
+
+	opts::options_description desc("Options");
+	opts::variables_map vm;
+	desc.add_options()
+	("nodes,n", opts::value<int>(&nNodes)->default_value(20), "number of nodes")
+	("max-indegree,k", opts::value<int>(&maxIndegree)->default_value(3), "maximum number of parents of a node")
+	("min-arity", opts::value<int>(&minArity)->default_value(2), "minimum number of values of a variable")
+	("max-arity", opts::value<int>(&maxArity)->default_value(3), "maximum number of values of a variable")
+	("samples,N", opts::value<int>(&nSamples)->default_value(1000), "number of samples")
+	("alpha,a", opts::value<double>(&alpha)->default_value(1.0), "Dirichlet concentration of the CPT rows")
+	("seed", opts::value<unsigned int>(&seed)->default_value(1), "random seed")
+	("data,o", opts::value<string>(&dataFile)->default_value("data.dat"), "output file for the samples")
+	("graph,g", opts::value<string>(&graphFile)->default_value("truth.dat"), "output file for the true graph")
+	("help,h", "produce help message");
+	try
+	{
+		opts::store(opts::command_line_parser(argc, argv).options(desc).run(), vm);
+		opts::notify(vm);
+	}
+	catch (opts::error &err)
+	{
+		cout << "Error:" << err.what() << endl;
+		return 1;
+	}
+	if (vm.count("help"))
+	{
+		cout << desc << endl;
+		return 1;
+	}
+	if (nNodes <= 0 || nSamples <= 0 || minArity < 1 || maxArity < minArity || maxArity > 255 || alpha <= 0)
+	{
+		cout << "Error: invalid network parameters" << endl;
+		return 1;
+	}
+
+	std::mt19937 gen(seed);
+	Network net;
+	generateNetwork(net, nNodes, maxIndegree, minArity, maxArity, alpha, gen);
+	ofstream dataOut(dataFile.c_str());
+	sampleNetwork(net, nSamples, gen, dataOut);
+	ofstream graphOut(graphFile.c_str());
+	writeGraph(net, graphOut);
+	if (!dataOut || !graphOut)
+	{
+		cout << "Error: could not write output files" << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "common.hpp"
+#include "logger.hpp"
+
+#ifndef HUGEPAGES_HPP
+#define HUGEPAGES_HPP
+
+enum PageMode
+{
+	PAGES_NORMAL,
+	PAGES_TRANSPARENT, // transparent huge pages requested with madvise
+	PAGES_HUGE,		   // explicit huge pages from the hugetlb pool
+	N_PAGE_MODES
+};
+
+static const char *const PAGE_MODE_NAMES[N_PAGE_MODES] = {"normal", "transparent", "huge"};
+
+// parses a PageMode name, throwing on unknown names
+PageMode parsePageMode(const std::string &name)
+{
+	for (int m = 0; m < N_PAGE_MODES; ++m)
+		if (name == PAGE_MODE_NAMES[m])
+			return (PageMode)m;
+	throw Exception("Unknown page mode %s") % name;
+}
+
+/**
+ * Maps the memory of large tables with the largest pages available, so
+ * that randomly indexed tables of gigabytes need few TLB entries. A
+ * request first tries explicit huge pages (mmap with MAP_HUGETLB, which
+ * needs pages reserved in /proc/sys/vm/nr_hugepages), then a huge page
+ * aligned normal mapping marked MADV_HUGEPAGE for transparent huge pages
+ * (unless they are disabled system-wide), and finally plain pages. The
+ * bytes mapped in each mode are counted for report().
+ */
+class PageAllocator
+{
+private:
+	std::atomic<int> maxMode_;
+	std::atomic<uint64_t> nBytes_[N_PAGE_MODES];
+	size_t hugePageSize_;
+	bool transparentEnabled_;
+
+	PageAllocator(const PageAllocator &);			 // disable copying
+	PageAllocator &operator=(const PageAllocator &); // disable copying
+
+	static size_t roundUp(size_t bytes, size_t unit)
+	{
+		return (bytes + unit - 1) / unit * unit;
+	}
+
+	// the huge page size of /proc/meminfo, 2 MB if it cannot be read
+	static size_t readHugePageSize()
+	{
+		size_t kb = 2048;
+		FILE *f = fopen("/proc/meminfo", "r");
+		if (f == NULL)
+			return kb << 10;
+		char line[256];
+		while (fgets(line, sizeof(line), f))
+			if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+				break;
+		fclose(f);
+		return kb << 10;
+	}
+
+	// false if transparent huge pages are switched off ("[never]")
+	static bool readTransparentEnabled()
+	{
+		FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+		if (f == NULL)
+			return false;
+		char line[256] = {0};
+		bool enabled = fgets(line, sizeof(line), f) != NULL && strstr(line, "[never]") == NULL;
+		fclose(f);
+		return enabled;
+	}
+
+public:
+	PageAllocator() : maxMode_(PAGES_HUGE), hugePageSize_(readHugePageSize()), transparentEnabled_(readTransparentEnabled())
+	{
+		for (int m = 0; m < N_PAGE_MODES; ++m)
+			nBytes_[m] = 0;
+	}
+
+	// the largest pages allocate() tries, e.g. PAGES_NORMAL to compare against plain pages
+	void setMaxMode(PageMode mode)
+	{
+		maxMode_ = mode;
+	}
+
+	PageMode getMaxMode() const
+	{
+		return (PageMode)maxMode_.load();
+	}
+
+	size_t getHugePageSize() const
+	{
+		return hugePageSize_;
+	}
+
+	/**
+	 * Maps at least bytes zeroed bytes; mode and mappedBytes receive what
+	 * release() needs. Throws std::bad_alloc if nothing can be mapped.
+	 */
+	void *allocate(size_t bytes, PageMode &mode, size_t &mappedBytes)
+	{
+		size_t length = roundUp(bytes, hugePageSize_);
+		void *p;
+		if (getMaxMode() >= PAGES_HUGE)
+		{
+			p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p != MAP_FAILED)
+			{
+				mode = PAGES_HUGE;
+				mappedBytes = length;
+				nBytes_[mode] += length;
+				logger.printfln(2, "pages: %zu bytes on %zu kB huge pages", length, hugePageSize_ >> 10);
+				return p;
+			}
+		}
+		// over-allocate by one huge page to cut out an aligned range
+		p = mmap(NULL, length + hugePageSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::bad_alloc();
+		uintptr_t start = roundUp((uintptr_t)p, hugePageSize_);
+		size_t head = start - (uintptr_t)p;
+		if (head)
+			munmap(p, head);
+		if (hugePageSize_ - head)
+			munmap((char *)start + length, hugePageSize_ - head);
+		mode = PAGES_NORMAL;
+		if (getMaxMode() >= PAGES_TRANSPARENT && transparentEnabled_ && madvise((void *)start, length, MADV_HUGEPAGE) == 0)
+			mode = PAGES_TRANSPARENT;
+		mappedBytes = length;
+		nBytes_[mode] += length;
+		logger.printfln(2, "pages: %zu bytes on %s pages", length, PAGE_MODE_NAMES[mode]);
+		return (void *)start;
+	}
+
+	void release(void *p, size_t mappedBytes)
+	{
+		munmap(p, mappedBytes);
+	}
+
+	// bytes mapped in mode since the start
+	uint64_t getNumBytes(PageMode mode) const
+	{
+		return nBytes_[mode];
+	}
+
+	// prints one line with the bytes mapped in each mode, nothing if no table was large enough
+	void report(std::ostream &out) const
+	{
+		uint64_t total = 0;
+		for (int m = 0; m < N_PAGE_MODES; ++m)
+			total += nBytes_[m];
+		if (total == 0)
+			return;
+		out << "table pages:";
+		for (int m = N_PAGE_MODES - 1; m >= 0; --m)
+			out << (m == N_PAGE_MODES - 1 ? " " : ", ") << PAGE_MODE_NAMES[m] << " " << (nBytes_[m] >> 20) << " MB";
+		out << std::endl;
+	}
+};
+
+PageAllocator pageAllocator;
+
+/**
+ * Array of size default-constructed elements. Arrays of at least one huge
+ * page are mapped through pageAllocator; smaller ones come from new[].
+ * The elements are never destroyed one by one, so T must be trivially
+ * destructible.
+ */
+template <class T>
+class LargeArray
+{
+private:
+	T *data_;
+	size_t size_;
+	size_t mappedBytes_; // 0 if allocated with new[]
+	PageMode mode_;
+
+	LargeArray(const LargeArray &);			   // disable copying
+	LargeArray &operator=(const LargeArray &); // disable copying
+
+public:
+	LargeArray(size_t size) : size_(size), mappedBytes_(0), mode_(PAGES_NORMAL)
+	{
+		if (size * sizeof(T) < pageAllocator.getHugePageSize())
+		{
+			data_ = new T[size];
+			return;
+		}
+		data_ = (T *)pageAllocator.allocate(size * sizeof(T), mode_, mappedBytes_);
+		for (size_t i = 0; i < size; ++i)
+			new (data_ + i) T;
+	}
+
+	~LargeArray()
+	{
+		if (mappedBytes_)
+			pageAllocator.release(data_, mappedBytes_);
+		else
+			delete[] data_;
+	}
+
+	T &operator[](size_t i)
+	{
+		return data_[i];
+	}
+
+	const T &operator[](size_t i) const
+	{
+		return data_[i];
+	}
+
+	T *get()
+	{
+		return data_;
+	}
+
+	const T *get() const
+	{
+		return data_;
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	PageMode getPageMode() const
+	{
+		return mode_;
+	}
+};
+
+#endif
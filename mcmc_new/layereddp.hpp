@@ -0,0 +1,214 @@
+#include <list>
+#include <vector>
+#include <string>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "common.hpp"
+#include "lognum.hpp"
+#include "data.hpp"
+#include "scores.hpp"
+#include "subsetrank.hpp"
+#include "bestdagdp.hpp"
+
+#ifndef LAYEREDDP_HPP
+#define LAYEREDDP_HPP
+
+/**
+ * Append-only file of fixed-width unsigned values packed bit by bit, read
+ * back at random positions. Used to keep the best sink of every subset on
+ * disk instead of in memory.
+ */
+class PackedSpillFile
+{
+private:
+	int fd_;
+	int bits_;
+	uint64_t nValues_;
+	uint64_t buffer_;	  // bits not yet written, least significant first
+	int nBuffered_;
+	std::vector<unsigned char> out_;
+
+	PackedSpillFile(const PackedSpillFile &);			 // disable copying
+	PackedSpillFile &operator=(const PackedSpillFile &); // disable copying
+
+	void writeOut()
+	{
+		size_t done = 0;
+		while (done < out_.size())
+		{
+			ssize_t w = write(fd_, &out_[done], out_.size() - done);
+			if (w <= 0)
+				throw Exception("Could not write to the spill file");
+			done += w;
+		}
+		out_.clear();
+	}
+
+public:
+	// creates an anonymous file in dir that disappears when closed
+	PackedSpillFile(const std::string &dir, int bits) : bits_(bits), nValues_(0), buffer_(0), nBuffered_(0)
+	{
+		assert(bits > 0 && bits <= 32);
+		std::string pattern = (dir.empty() ? std::string("/tmp") : dir) + "/bestdag-spill-XXXXXX";
+		std::vector<char> path(pattern.begin(), pattern.end());
+		path.push_back('\0');
+		fd_ = mkstemp(&path[0]);
+		if (fd_ < 0)
+			throw Exception("Could not create a spill file in %s") % (dir.empty() ? "/tmp" : dir);
+		unlink(&path[0]);
+		out_.reserve(1 << 20);
+	}
+
+	~PackedSpillFile()
+	{
+		close(fd_);
+	}
+
+	uint64_t size() const
+	{
+		return nValues_;
+	}
+
+	uint64_t getNumBytes() const
+	{
+		return (nValues_ * bits_ + 7) / 8;
+	}
+
+	void push(uint32_t value)
+	{
+		buffer_ |= (uint64_t)value << nBuffered_;
+		nBuffered_ += bits_;
+		while (nBuffered_ >= 8)
+		{
+			out_.push_back(buffer_ & 0xff);
+			buffer_ >>= 8;
+			nBuffered_ -= 8;
+		}
+		if (out_.size() >= (1 << 20))
+			writeOut();
+		++nValues_;
+	}
+
+	// writes out everything pushed so far, after which get() can be used
+	void flush()
+	{
+		if (nBuffered_ > 0)
+		{
+			out_.push_back(buffer_ & 0xff);
+			buffer_ = 0;
+			nBuffered_ = 0;
+		}
+		writeOut();
+	}
+
+	uint32_t get(uint64_t index) const
+	{
+		assert(index < nValues_);
+		uint64_t bitPos = index * bits_;
+		unsigned char bytes[8] = {0};
+		if (pread(fd_, bytes, (bits_ + 7 + bitPos % 8) / 8, bitPos / 8) < 0)
+			throw Exception("Could not read the spill file");
+		uint64_t word = 0;
+		for (int i = 7; i >= 0; --i)
+			word = (word << 8) | bytes[i];
+		return (word >> (bitPos % 8)) & (((uint64_t)1 << bits_) - 1);
+	}
+};
+
+/**
+ * Exact search that processes the subsets one cardinality layer at a time.
+ * Only the best scores of two neighbouring layers are kept in memory, and
+ * the parent set scores are held by SparseBestParents, so memory is
+ * proportional to the widest layer C(n, n/2) instead of n 2^n. The best
+ * sink of every subset, needed for backtracking, is spilled to a file in
+ * spillDir in bit-packed form. Finds the same order as findBestDAG.
+ */
+void findBestDAGLayered(const SparseBestParents &bestPa, int n, list<int> &order, const std::string &spillDir = "")
+{
+	if (n >= 64)
+		throw Exception("Layered search supports at most 63 variables, the data has %d") % n;
+	SubsetRanker ranker(n, n);
+
+	int bits = 1;
+	while (((uint64_t)1 << bits) < (uint64_t)n)
+		++bits;
+	PackedSpillFile sinks(spillDir, bits);
+	std::vector<uint64_t> layerStart(n + 1); // index of the first sink of each layer in the spill file
+
+	std::vector<double> prev(1, 0.0), cur;
+	std::vector<int> items(n);
+	std::vector<size_t> prefix(n + 1), suffix(n + 1);
+	layerStart[0] = 0;
+	for (int l = 1; l <= n; ++l)
+	{
+		layerStart[l] = sinks.size();
+		size_t layerSize = ranker.binom(n, l);
+		cur.assign(layerSize, -std::numeric_limits<double>::infinity());
+		uint64_t ss = ((uint64_t)1 << l) - 1;
+		for (size_t r = 0; r < layerSize; ++r)
+		{
+			// rank of ss minus its p-th element: the elements after p move down one position
+			int m = 0;
+			for (uint64_t rest = ss; rest; rest &= rest - 1)
+				items[m++] = __builtin_ctzll(rest);
+			prefix[0] = 0;
+			for (int p = 0; p < l; ++p)
+				prefix[p + 1] = prefix[p] + ranker.binom(items[p], p + 1);
+			suffix[l] = 0;
+			for (int p = l - 1; p >= 0; --p)
+				suffix[p] = suffix[p + 1] + ranker.binom(items[p], p);
+
+			double score = -std::numeric_limits<double>::infinity();
+			int sink = 0;
+			for (int p = 0; p < l; ++p)
+			{
+				int i = items[p];
+				uint64_t sss = ss & ~((uint64_t)1 << i);
+				size_t subRank = prefix[p] + suffix[p + 1];
+				double newScore = prev[subRank] + log(bestPa.getScore(i, sss));
+				if (newScore > score)
+				{
+					score = newScore;
+					sink = i;
+				}
+			}
+			cur[r] = score;
+			sinks.push(sink);
+
+			// next subset of the same size in colex order (Gosper's hack)
+			uint64_t c = ss & -ss;
+			uint64_t t = ss + c;
+			ss = t | (((t ^ ss) >> 2) / c);
+		}
+		prev.swap(cur);
+	}
+	sinks.flush();
+
+	// backtracking
+	uint64_t ss = ((uint64_t)1 << n) - 1;
+	for (int l = n; l > 0; --l)
+	{
+		int i = sinks.get(layerStart[l] + (ranker.rankMask(ss) - ranker.getSizeOffset(l)));
+		order.push_front(i);
+		ss &= ~((uint64_t)1 << i);
+	}
+}
+
+void findBestDAGLayered(const DataView &data, int maxParents, const ScoreFun *scoreFun, list<int> &order,
+						const std::string &spillDir = "")
+{
+	int n = data.getNumVariables();
+	// before the scores of all parent sets are computed
+	if (n >= 64)
+		throw Exception("Layered search supports at most 63 variables, the data has %d") % n;
+	SparseParentsetMap<Real> scores(n, maxParents);
+	computeScores(data, scoreFun, scores);
+	SparseBestParents bestPa(scores);
+	findBestDAGLayered(bestPa, n, order, spillDir);
+}
+
+#endif
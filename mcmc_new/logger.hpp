@@ -1,80 +1,429 @@
 #include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <csignal>
+#include <stdint.h>
+#include <unistd.h>
 
 #ifndef LOGGER_HPP
 #define LOGGER_HPP
 
+/*
+ * Byte ring of one writing thread. The thread appends records
+ *   uint32 length, uint64 sequence number, length bytes of text
+ * and the drain thread consumes them; head and tail count bytes. While a
+ * record is being appended, inFlight is at most its sequence number. A
+ * ring whose thread has exited is handed to the next new thread.
+ */
+struct LogRing {
+	static const size_t CAPACITY = 1 << 16;
+	static const uint64_t NONE = ~(uint64_t)0;
+	char bytes[CAPACITY];
+	std::atomic<uint64_t> head; // advanced by the drain
+	std::atomic<uint64_t> tail; // advanced by the owning thread
+	std::atomic<uint64_t> inFlight; // NONE between appends
+	std::atomic<bool> owned; // by a running thread
+	std::chrono::steady_clock::time_point lastProgress; // owner only
+	uint64_t nDropped; // owner only
+
+	LogRing() : head(0), tail(0), inFlight(NONE), owned(false), lastProgress(), nDropped(0) {}
+
+	void copyIn(uint64_t pos, const void* src, size_t size) {
+		size_t at = pos % CAPACITY;
+		size_t first = size < CAPACITY - at ? size : CAPACITY - at;
+		memcpy(bytes + at, src, first);
+		memcpy(bytes, (const char*)src + first, size - first);
+	}
+
+	void copyOut(uint64_t pos, void* dst, size_t size) const {
+		size_t at = pos % CAPACITY;
+		size_t first = size < CAPACITY - at ? size : CAPACITY - at;
+		memcpy(dst, bytes + at, first);
+		memcpy((char*)dst + first, bytes, size - first);
+	}
+};
+
+/**
+ * Leveled log to stderr that keeps writing threads off the terminal.
+ * Messages are formatted by the calling thread into its own ring buffer,
+ * which takes no lock; a background thread drains the rings every few
+ * milliseconds and writes the messages in the order they were logged. A
+ * message that finds its thread's ring full is dropped and counted rather
+ * than waited for. progress() messages are additionally limited to one per
+ * interval and thread. The destructor, flush() and, after
+ * installCrashHandlers(), the fatal signals write out everything pending.
+ * A drain writes only the messages older than every message still being
+ * appended and holds back the rest, so the order is kept across drains.
+ * Threads must not log after the logger is destroyed.
+ *
+ * Verbosity levels: 0 errors only, 1 normal output (default), 2 details,
+ * 3 debugging.
+ */
 class Logger {
 private:
-	int verbosity_;
-	
+	static const int MAX_RINGS = 256;
+
+	std::atomic<int> verbosity_;
+	std::atomic<int64_t> progressIntervalNs_;
+	std::atomic<uint64_t> sequence_;
+	LogRing* rings_[MAX_RINGS];
+	std::atomic<int> nRings_;
+	std::atomic<uint64_t> nUnregistered_; // messages of threads beyond MAX_RINGS running ones
+	std::mutex registerMutex_;
+	std::mutex drainMutex_; // one drain at a time
+	std::atomic<bool> consuming_; // a drain or emergencyDrain is reading the rings
+	std::mutex wakeMutex_;
+	std::condition_variable wake_;
+	bool stop_;
+	std::thread thread_;
+
+	struct Pending {
+		uint64_t sequence;
+		std::string text;
+		bool operator<(const Pending& other) const {
+			return sequence < other.sequence;
+		}
+	};
+
+	std::vector<Pending> held_; // drained but not yet safe to write, by drainMutex_
+
+	// the ring of the calling thread, given back when the thread exits
+	struct ThreadRing {
+		Logger* owner;
+		LogRing* ring;
+
+		ThreadRing() : owner(NULL), ring(NULL) {}
+
+		~ThreadRing() {
+			if (ring)
+				ring->owned.store(false, std::memory_order_release);
+		}
+	};
+
+	Logger(const Logger&);			  // disable copying
+	Logger& operator=(const Logger&); // disable copying
+
+	static Logger*& crashLogger() {
+		static Logger* logger = NULL;
+		return logger;
+	}
+
+	LogRing* getThreadRing() {
+		static thread_local ThreadRing current;
+		if (current.owner != this || current.ring == NULL) {
+			std::lock_guard<std::mutex> lock(registerMutex_);
+			current.owner = this;
+			current.ring = NULL;
+			int n = nRings_.load();
+			for (int r = 0; r < n && current.ring == NULL; ++r) {
+				bool owned = false;
+				if (rings_[r]->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+					current.ring = rings_[r];
+			}
+			if (current.ring == NULL && n < MAX_RINGS) {
+				current.ring = new LogRing();
+				current.ring->owned = true;
+				rings_[n] = current.ring;
+				nRings_.store(n + 1);
+			}
+			if (current.ring)
+				current.ring->lastProgress = std::chrono::steady_clock::time_point();
+			// the drain starts with the first message, so programs that never log have no extra thread
+			if (!thread_.joinable())
+				thread_ = std::thread(&Logger::run, this);
+		}
+		return current.ring;
+	}
+
+	void append(const char* text, size_t size) {
+		LogRing* ring = getThreadRing();
+		if (ring == NULL) {
+			nUnregistered_.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		uint32_t length = size < LogRing::CAPACITY / 4 ? size : LogRing::CAPACITY / 4;
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		size_t needed = sizeof(uint32_t) + sizeof(uint64_t) + length;
+		if (tail + needed - ring->head.load(std::memory_order_acquire) > LogRing::CAPACITY) {
+			++ring->nDropped;
+			return;
+		}
+		// a drain that misses this record sees inFlight, a lower bound of its sequence number
+		ring->inFlight.store(sequence_.load());
+		uint64_t sequence = sequence_.fetch_add(1);
+		ring->copyIn(tail, &length, sizeof(length));
+		ring->copyIn(tail + sizeof(length), &sequence, sizeof(sequence));
+		ring->copyIn(tail + sizeof(length) + sizeof(sequence), text, length);
+		ring->tail.store(tail + needed, std::memory_order_release);
+		ring->inFlight.store(LogRing::NONE, std::memory_order_release);
+	}
+
+	void vappend(const char* fmt, va_list args, bool newline) {
+		char buffer[1024];
+		int size = vsnprintf(buffer, sizeof(buffer) - 1, fmt, args);
+		if (size < 0)
+			return;
+		if (size > (int)sizeof(buffer) - 2)
+			size = sizeof(buffer) - 2;
+		if (newline)
+			buffer[size++] = '\n';
+		append(buffer, size);
+	}
+
+	template <class A>
+	void appendStream(const A& a) {
+		std::ostringstream out;
+		out << a;
+		std::string text = out.str();
+		append(text.data(), text.size());
+	}
+
+	/**
+	 * Moves the pending messages of all rings to stderr, in logging order.
+	 * Messages from the oldest one still being appended on are held back
+	 * for the next drain unless all is set. Returns the sequence number
+	 * below which every message has been written.
+	 */
+	uint64_t drain(bool all = false) {
+		std::lock_guard<std::mutex> lock(drainMutex_);
+		while (consuming_.exchange(true, std::memory_order_acquire))
+			std::this_thread::yield();
+		// every record not seen below has a sequence number of at least ready
+		uint64_t ready = sequence_.load();
+		int n = nRings_.load();
+		for (int r = 0; r < n; ++r) {
+			uint64_t inFlight = rings_[r]->inFlight.load();
+			if (inFlight < ready)
+				ready = inFlight;
+		}
+		std::vector<Pending> pending;
+		pending.swap(held_);
+		for (int r = 0; r < n; ++r) {
+			LogRing* ring = rings_[r];
+			uint64_t head = ring->head.load(std::memory_order_relaxed);
+			uint64_t tail = ring->tail.load(std::memory_order_acquire);
+			while (head < tail) {
+				uint32_t length;
+				Pending p;
+				ring->copyOut(head, &length, sizeof(length));
+				ring->copyOut(head + sizeof(length), &p.sequence, sizeof(p.sequence));
+				p.text.resize(length);
+				if (length)
+					ring->copyOut(head + sizeof(length) + sizeof(p.sequence), &p.text[0], length);
+				head += sizeof(length) + sizeof(p.sequence) + length;
+				pending.push_back(p);
+			}
+			ring->head.store(head, std::memory_order_release);
+		}
+		std::sort(pending.begin(), pending.end());
+		Pending bound;
+		bound.sequence = ready;
+		size_t nReady = all ? pending.size() : std::lower_bound(pending.begin(), pending.end(), bound) - pending.begin();
+		for (size_t i = 0; i < nReady; ++i)
+			fwrite(pending[i].text.data(), 1, pending[i].text.size(), stderr);
+		fflush(stderr);
+		held_.assign(pending.begin() + nReady, pending.end());
+		consuming_.store(false, std::memory_order_release);
+		return ready;
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(wakeMutex_);
+		while (!stop_) {
+			wake_.wait_for(lock, std::chrono::milliseconds(20));
+			lock.unlock();
+			drain();
+			lock.lock();
+		}
+	}
+
+	// writes the pending bytes of every ring with write(2) only, from a signal handler
+	void emergencyDrain() {
+		// a drain interrupted by the signal, or running on another thread, owns the messages
+		if (consuming_.exchange(true, std::memory_order_acquire))
+			return;
+		for (size_t i = 0; i < held_.size(); ++i)
+			if (write(2, held_[i].text.data(), held_[i].text.size()) < 0)
+				return;
+		int n = nRings_.load();
+		for (int r = 0; r < n; ++r) {
+			LogRing* ring = rings_[r];
+			uint64_t head = ring->head.load(std::memory_order_relaxed);
+			uint64_t tail = ring->tail.load(std::memory_order_acquire);
+			while (head < tail) {
+				uint32_t length;
+				ring->copyOut(head, &length, sizeof(length));
+				head += sizeof(length) + sizeof(uint64_t);
+				size_t at = head % LogRing::CAPACITY;
+				size_t first = length < LogRing::CAPACITY - at ? length : LogRing::CAPACITY - at;
+				if (write(2, ring->bytes + at, first) < 0 || write(2, ring->bytes, length - first) < 0)
+					return;
+				head += length;
+			}
+			ring->head.store(head, std::memory_order_release);
+		}
+		consuming_.store(false, std::memory_order_release);
+	}
+
+	static void crashHandler(int sig) {
+		Logger* logger = crashLogger();
+		if (logger)
+			logger->emergencyDrain();
+		signal(sig, SIG_DFL);
+		raise(sig);
+	}
+
 public:
+	Logger()
+		: verbosity_(1), progressIntervalNs_(500000000), sequence_(0), nRings_(0), nUnregistered_(0), consuming_(false),
+		  stop_(false) {}
+
+	~Logger() {
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex_);
+			stop_ = true;
+		}
+		wake_.notify_one();
+		if (thread_.joinable())
+			thread_.join();
+		drain(true);
+		if (crashLogger() == this)
+			crashLogger() = NULL;
+		uint64_t nDropped = nUnregistered_;
+		for (int r = 0; r < nRings_; ++r) {
+			nDropped += rings_[r]->nDropped;
+			delete rings_[r];
+		}
+		if (nDropped)
+			fprintf(stderr, "logger: %llu messages dropped\n", (unsigned long long)nDropped);
+	}
+
+	// flushes the log when the process is killed by a fatal signal
+	void installCrashHandlers() {
+		crashLogger() = this;
+		const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGTERM, SIGINT};
+		for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i)
+			signal(signals[i], &Logger::crashHandler);
+	}
+
 	void setVerbosity(int v) {
-		verbosity_ = v;
+		verbosity_.store(v, std::memory_order_relaxed);
 	}
-	
+
+	int getVerbosity() const {
+		return verbosity_.load(std::memory_order_relaxed);
+	}
+
+	bool isEnabled(int minVerbosity) const {
+		return verbosity_.load(std::memory_order_relaxed) >= minVerbosity;
+	}
+
+	// minimum time between two progress messages of a thread
+	void setProgressInterval(double seconds) {
+		progressIntervalNs_.store((int64_t)(seconds * 1e9), std::memory_order_relaxed);
+	}
+
 	void printf(int minVerbosity, const char* fmt, ...) {
-		if (verbosity_ < minVerbosity) return;
+		if (!isEnabled(minVerbosity)) return;
 		va_list args;
 		va_start(args, fmt);
-		vfprintf(stderr, fmt, args);
+		vappend(fmt, args, false);
 		va_end(args);
 	}
-	
+
 	void printfln(int minVerbosity, const char* fmt, ...) {
-		if (verbosity_ < minVerbosity) return;
+		if (!isEnabled(minVerbosity)) return;
 		va_list args;
 		va_start(args, fmt);
-		vfprintf(stderr, fmt, args);
+		vappend(fmt, args, true);
+		va_end(args);
+	}
+
+	// printfln that is skipped if the thread logged progress less than an interval ago
+	void progress(int minVerbosity, const char* fmt, ...) {
+		if (!isEnabled(minVerbosity)) return;
+		LogRing* ring = getThreadRing();
+		if (ring == NULL) return;
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (ring->lastProgress != std::chrono::steady_clock::time_point() &&
+			now - ring->lastProgress < std::chrono::nanoseconds(progressIntervalNs_.load(std::memory_order_relaxed)))
+			return;
+		ring->lastProgress = now;
+		va_list args;
+		va_start(args, fmt);
+		vappend(fmt, args, true);
 		va_end(args);
-		std::cerr << std::endl;
-		//fprintf(stderr, "\n");
-		//std::cerr << std::flush;
 	}
 
 	void println(int minVerbosity) {
-		if (verbosity_ < minVerbosity) return;
-		std::cerr << std::endl;
+		if (!isEnabled(minVerbosity)) return;
+		append("\n", 1);
 	}
-	
+
 	template <class A>
 	void print(int minVerbosity, A a) {
-		if (verbosity_ < minVerbosity) return;
-		std::cerr << a;
+		if (!isEnabled(minVerbosity)) return;
+		appendStream(a);
 	}
 
 	template <class A>
 	void println(int minVerbosity, A a) {
-		if (verbosity_ < minVerbosity) return;
-		std::cerr << a << std::endl;
+		if (!isEnabled(minVerbosity)) return;
+		std::ostringstream out;
+		out << a << '\n';
+		appendStream(out.str());
 	}
 
 	template <class A, class B>
 	void print(int minVerbosity, A a, B b) {
-		if (verbosity_ < minVerbosity) return;
-		std::cerr << a << b;
+		if (!isEnabled(minVerbosity)) return;
+		std::ostringstream out;
+		out << a << b;
+		appendStream(out.str());
 	}
 
 	template <class A, class B>
 	void println(int minVerbosity, A a, B b) {
-		if (verbosity_ < minVerbosity) return;
-		std::cerr << a << b << std::endl;
+		if (!isEnabled(minVerbosity)) return;
+		std::ostringstream out;
+		out << a << b << '\n';
+		appendStream(out.str());
 	}
 
 	template <class A, class B, class C>
 	void print(int minVerbosity, A a, B b, C c) {
-		if (verbosity_ < minVerbosity) return;
-		std::cerr << a << b << c;
+		if (!isEnabled(minVerbosity)) return;
+		std::ostringstream out;
+		out << a << b << c;
+		appendStream(out.str());
 	}
 
 	template <class A, class B, class C>
 	void println(int minVerbosity, A a, B b, C c) {
-		if (verbosity_ < minVerbosity) return;
-		std::cerr << a << b << c << std::endl;
+		if (!isEnabled(minVerbosity)) return;
+		std::ostringstream out;
+		out << a << b << c << '\n';
+		appendStream(out.str());
 	}
-	
+
+	// writes out everything logged so far before returning
 	void flush() {
-		std::cerr << std::flush;
+		uint64_t logged = sequence_.load();
+		while (drain() < logged)
+			std::this_thread::yield();
 	}
 };
 
+Logger logger;
+
 #endif
@@ -1,6 +1,7 @@
-//#include <cmath>
+#include <cmath>
 //#include <cfloat>
 #include <limits>
+#include <vector>
 
 //#define NDEBUG
 #include <cassert>
@@ -15,7 +16,97 @@
 //struct __identity { typedef T type; };
 
 
-template <class T>
+/*
+ * Log-add policies of Lognum: log1pExp(d) = log(1 + e^-d) for d >= 0 is the
+ * term that operator+ adds to the larger logarithm, and log1mExp(d) =
+ * log(1 - e^-d) for d >= 0 the one that operator- adds.
+ */
+
+// computes the terms with log1p and exp (the default)
+struct ExactLogAdd {
+	static double log1pExp(double d) {
+		return log1p(exp(-d));
+	}
+
+	static double log1mExp(double d) {
+		return log1p(-exp(-d));
+	}
+};
+
+/**
+ * Computes the terms by cubic Hermite interpolation between values and
+ * slopes tabulated every 1/16 on [0, 37]. The absolute error is below 5e-9
+ * for log1pExp and below 1.5e-8 for log1mExp (the h^4/384 max|f''''| bound
+ * of the interpolation, checked against long double on a 1e-6 grid).
+ * log1mExp(d) goes to -infinity at 0, so below d = 2 it is computed
+ * exactly. From d = 37 on both terms are below 2^-53 and taken as 0, which
+ * is what adding them to a logarithm of magnitude 1 or more gives in
+ * double precision anyway. The two tables take 19 kB and are built on
+ * first use.
+ */
+struct FastLogAdd {
+	static const int STEPS = 16; // table entries per unit of d
+	static const int RANGE = 37; // log(2^53) = 36.7
+	static const int EXACT_BELOW = 2; // log1mExp
+
+	struct Knot {
+		double value;
+		double slope; // derivative times the step 1/STEPS
+	};
+
+	static std::vector<Knot> buildTable(bool add) {
+		std::vector<Knot> table(RANGE * STEPS + 2);
+		for (size_t k = 0; k < table.size(); ++k) {
+			double d = (double)k / STEPS, e = exp(-d);
+			if (add) {
+				table[k].value = log1p(e);
+				table[k].slope = -e / (1 + e) / STEPS;
+			} else {
+				// entries below EXACT_BELOW are never read, and d = 0 is singular
+				table[k].value = k ? log1p(-e) : 0;
+				table[k].slope = k ? e / (1 - e) / STEPS : 0;
+			}
+		}
+		return table;
+	}
+
+	static const Knot *addTable() {
+		static const std::vector<Knot> table = buildTable(true);
+		return &table[0];
+	}
+
+	static const Knot *subtractTable() {
+		static const std::vector<Knot> table = buildTable(false);
+		return &table[0];
+	}
+
+	// the interpolant of the tabulated function at d in [0, RANGE)
+	static double interpolate(const Knot *table, double d) {
+		double x = d * STEPS;
+		int k = (int)x;
+		double t = x - k;
+		double t2 = t * t, u = 1 - t, u2 = u * u;
+		return (1 + 2 * t) * u2 * table[k].value + t * u2 * table[k].slope +
+			t2 * (3 - 2 * t) * table[k + 1].value - t2 * u * table[k + 1].slope;
+	}
+
+	static double log1pExp(double d) {
+		if (d < RANGE)
+			return interpolate(addTable(), d);
+		return d == d ? 0 : d; // NaN stays NaN
+	}
+
+	static double log1mExp(double d) {
+		if (d < EXACT_BELOW)
+			return log1p(-exp(-d));
+		if (d < RANGE)
+			return interpolate(subtractTable(), d);
+		return d == d ? 0 : d;
+	}
+};
+
+
+template <class T, class LogAdd = ExactLogAdd>
 struct Lognum {
 private:
 	T logx_;
@@ -74,8 +165,8 @@ public:
 			res = *this;
 		else
 			res.logx_ = (logx_ > b.logx_) ?
-					logx_ + log1p(exp(b.logx_ - logx_)) :
-					b.logx_ + log1p(exp(logx_ - b.logx_));
+					logx_ + LogAdd::log1pExp(logx_ - b.logx_) :
+					b.logx_ + LogAdd::log1pExp(b.logx_ - logx_);
 					//logx_ + log(1.0 + exp(b.logx_ - logx_)) :
 					//b.logx_ + log(1.0 + exp(logx_ - b.logx_));
 		return res;
@@ -95,7 +186,7 @@ public:
 		else if (logx_ < b.logx_)
 			res.logx_ = -std::numeric_limits<T>::infinity();
 		else
-			res.logx_ = logx_ + log1p(-exp(b.logx_ - logx_));
+			res.logx_ = logx_ + LogAdd::log1mExp(logx_ - b.logx_);
 			//res.logx_ = logx_ + log(1.0 - exp(b.logx_ - logx_));
 		return res;
 	}
@@ -146,8 +237,8 @@ public:
 };
 
 
-template <typename T>
-T log(Lognum<T> x){
+template <typename T, class LogAdd>
+T log(Lognum<T, LogAdd> x){
 	return x.getLog();
 }
 
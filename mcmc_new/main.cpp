@@ -14,8 +14,13 @@
 #include "data.hpp"
 #include "stacksubset.hpp"
 #include "scores.hpp"
+#include "hugepages.hpp"
 #include "bestdagdp.hpp"
 #include "order.hpp"
+#include "exactsearch.hpp"
+#include "samplers.hpp"
+#include "tempering.hpp"
+#include "trace.hpp"
 #include <boost/program_options.hpp>
 using std::list;
 using std::vector;
@@ -28,6 +33,14 @@ int main(int argc, char **argv)
     int burn_in;
     int max_parent_size;
     int swap_n;
+    string traceFile;
+    string engine;
+    string spillDir;
+    string moves;
+    string sampler;
+    string pages;
+    int verbosity;
+    MCMCOptions mcmcOptions;
 
 
     opts::options_description desc("Options");
@@ -37,6 +50,27 @@ int main(int argc, char **argv)
     ("burn-size,b", opts::value<int>(&burn_in)->default_value(1000), "number of burn-in")
     ("max-parent-size,m", opts::value<int>(&max_parent_size)->default_value(3), "maximum size of parent set")
     ("swap-n,s",opts::value<int>(&swap_n)->default_value(5),"set num of variables for swaping every loop")
+    ("sampler", opts::value<string>(&sampler)->default_value("order"), "sampler of the mcmc engine: order, partition or structure")
+    ("replicas", opts::value<int>(&mcmcOptions.replicas)->default_value(1), "number of tempered order chains run in parallel")
+    ("swap-interval", opts::value<int>(&mcmcOptions.swapInterval)->default_value(10), "iterations between replica exchanges")
+    ("block-memo", opts::value<size_t>(&mcmcOptions.blockMemoSize)->default_value(65536), "number of block move target sets whose best order is remembered (0 disables)")
+    ("fast-log-add", "sum the scores of the partition sampler's parent set draws with the interpolated log-add (error below 5e-9) instead of log1p and exp")
+    ("moves", opts::value<string>(&moves)->default_value("block"), "mixture of order moves, e.g. adjacent=0.6,reinsert=0.3,block=0.1")
+    ("engine,e", opts::value<string>(&engine)->default_value("mcmc"), "structure learning engine: mcmc, dp, layered or astar")
+    ("prune", "eliminate parent sets that cannot be optimal before searching")
+    ("pages", opts::value<string>(&pages)->default_value("huge"), "largest pages tried for the big DP and score tables: huge, transparent or normal")
+    ("spill-dir", opts::value<string>(&spillDir), "directory for the backtracking data of the layered engine (default /tmp)")
+    ("seed", opts::value<unsigned int>(&mcmcOptions.seed)->default_value(0), "random seed (0 for a random seed)")
+    ("checkpoint,c", opts::value<string>(&mcmcOptions.checkpointFile), "periodically write the chain state to this file")
+    ("checkpoint-interval", opts::value<int>(&mcmcOptions.checkpointInterval)->default_value(100), "number of iterations between checkpoints")
+    ("resume", "continue the run stored in the checkpoint file")
+    ("score-store", opts::value<string>(&mcmcOptions.scoreStore), "directory of local score stores shared across runs")
+    ("samples", opts::value<string>(&mcmcOptions.samplesFile), "stream every retained order and DAG to this compressed file")
+    ("metrics", opts::value<string>(&mcmcOptions.metricsFile), "write a JSON summary of the run metrics to this file")
+    ("metrics-log", opts::value<string>(&mcmcOptions.metricsLog), "append periodic JSON lines of the run metrics to this file")
+    ("trace", opts::value<string>(&traceFile), "write a Chrome trace-event timeline to this file")
+    ("metrics-interval", opts::value<int>(&mcmcOptions.metricsInterval)->default_value(100), "number of iterations between metrics lines")
+    ("verbosity,v", opts::value<int>(&verbosity)->default_value(1), "0 errors only, 1 progress, 2 details, 3 debugging output on stderr")
     ("help,h", "produce help message");
     opts::positional_options_description pdesc;
     pdesc.add("input-file", 1);
@@ -57,21 +91,97 @@ int main(int argc, char **argv)
         cout << desc << endl;
         return 1;
     }
+    mcmcOptions.resume = vm.count("resume") > 0;
+    if (mcmcOptions.resume && mcmcOptions.checkpointFile.empty())
+    {
+        cout << "Error: --resume requires --checkpoint" << endl;
+        return 1;
+    }
+    if (mcmcOptions.checkpointInterval <= 0 || mcmcOptions.metricsInterval <= 0)
+    {
+        cout << "Error: checkpoint and metrics intervals must be positive" << endl;
+        return 1;
+    }
+    if (sampler != "order" && sampler != "partition" && sampler != "structure")
+    {
+        cout << "Error: unknown sampler " << sampler << endl;
+        return 1;
+    }
+    if ((sampler != "order" || mcmcOptions.replicas > 1) && !mcmcOptions.checkpointFile.empty())
+    {
+        cout << "Error: checkpoints are only supported by the single-chain order sampler" << endl;
+        return 1;
+    }
+    if (sampler != "order" && !mcmcOptions.samplesFile.empty())
+    {
+        cout << "Error: sample files are only written by the order sampler" << endl;
+        return 1;
+    }
+    if (mcmcOptions.replicas < 1 || mcmcOptions.swapInterval < 1)
+    {
+        cout << "Error: replicas and swap interval must be positive" << endl;
+        return 1;
+    }
+    try
+    {
+        parseMoveMixture(moves, mcmcOptions.moveWeights);
+        pageAllocator.setMaxMode(parsePageMode(pages));
+    }
+    catch (Exception &err)
+    {
+        cout << "Error: " << err.what() << endl;
+        return 1;
+    }
 
+    logger.setVerbosity(verbosity);
+    logger.installCrashHandlers();
+    if (!traceFile.empty())
+        tracer.enable();
+    metrics.setEnabled(!mcmcOptions.metricsFile.empty() || !mcmcOptions.metricsLog.empty());
     Data data;
-    istream inStream(0);
-    ifstream inFile;
-    inFile.open(inputfile);
-    inStream.rdbuf(inFile.rdbuf());
-    data.read(inStream);
-    if (inFile.is_open())
-        inFile.close();
+    {
+        TraceSpan span("load");
+        istream inStream(0);
+        ifstream inFile;
+        inFile.open(inputfile);
+        inStream.rdbuf(inFile.rdbuf());
+        data.read(inStream);
+        if (inFile.is_open())
+            inFile.close();
+    }
     int nVariables = data.nVariables;
     vector<int> targets;
     for (int i = 0; i < nVariables; ++i)
     {
         targets.push_back(i);
     }
-    myMCMC(data, targets, burn_in, max_parent_size, swap_n);
+    mcmcOptions.burnIn = burn_in;
+    mcmcOptions.maxParentSize = max_parent_size;
+    mcmcOptions.swapN = swap_n;
+    mcmcOptions.pruneParents = vm.count("prune") > 0;
+    mcmcOptions.fastLogAdd = vm.count("fast-log-add") > 0;
+    try
+    {
+        if (engine == "mcmc" && sampler == "partition")
+            partitionMCMC(data, targets, mcmcOptions);
+        else if (engine == "mcmc" && sampler == "structure")
+            structureMCMC(data, targets, mcmcOptions);
+        else if (engine == "mcmc" && mcmcOptions.replicas > 1)
+            temperedMCMC(data, targets, mcmcOptions);
+        else if (engine == "mcmc")
+            myMCMC(data, targets, mcmcOptions);
+        else
+            exactSearch(data, targets, max_parent_size, engine, mcmcOptions.pruneParents, spillDir);
+    }
+    catch (Exception &err)
+    {
+        cout << "Error: " << err.what() << endl;
+        return 1;
+    }
+    if (!traceFile.empty() && !tracer.writeChromeTrace(traceFile))
+    {
+        cout << "Error: could not write " << traceFile << endl;
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+#include <boost/format.hpp>
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+enum MetricsPhase
+{
+	PHASE_COUNTING,
+	PHASE_SCORING,
+	PHASE_BLOCK_DP,
+	PHASE_ORDER_SCORING,
+	PHASE_ORDER2DAG,
+	N_PHASES
+};
+
+static const char *const METRICS_PHASE_NAMES[N_PHASES] = {
+	"counting", "scoring", "block_dp", "order_scoring", "order2dag"};
+
+/**
+ * Runtime counters of a learning run. Phase times are wall-clock and
+ * inclusive, e.g. counting that happens on a cache miss inside order
+ * scoring is part of both. All counters may be updated from any thread.
+ * Phase times and call counts are only taken while the metrics are
+ * enabled, so runs that report none do not read the clock in every score
+ * computation.
+ */
+class Metrics
+{
+private:
+	std::atomic<bool> enabled_;
+	std::atomic<uint64_t> phaseNanos_[N_PHASES];
+	std::atomic<uint64_t> computeScoreCalls_;
+	std::atomic<uint64_t> cacheHits_;
+	std::atomic<uint64_t> cacheMisses_;
+	std::atomic<uint64_t> iterations_;
+	std::atomic<uint64_t> proposals_;
+	std::atomic<uint64_t> accepted_;
+	std::atomic<double> currentScore_;
+	std::chrono::steady_clock::time_point start_;
+
+public:
+	Metrics() : enabled_(false)
+	{
+		reset();
+	}
+
+	void setEnabled(bool enabled)
+	{
+		enabled_ = enabled;
+	}
+
+	bool isEnabled() const
+	{
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	void reset()
+	{
+		for (int i = 0; i < N_PHASES; ++i)
+			phaseNanos_[i] = 0;
+		computeScoreCalls_ = 0;
+		cacheHits_ = 0;
+		cacheMisses_ = 0;
+		iterations_ = 0;
+		proposals_ = 0;
+		accepted_ = 0;
+		currentScore_ = 0;
+		start_ = std::chrono::steady_clock::now();
+	}
+
+	void addPhaseTime(MetricsPhase phase, uint64_t nanos)
+	{
+		phaseNanos_[phase].fetch_add(nanos, std::memory_order_relaxed);
+	}
+
+	void countComputeScore()
+	{
+		if (isEnabled())
+			computeScoreCalls_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// caches keep their own counters and publish them here
+	void setCacheStats(uint64_t hits, uint64_t misses)
+	{
+		cacheHits_ = hits;
+		cacheMisses_ = misses;
+	}
+
+	void countIteration(bool proposed, bool accepted)
+	{
+		if (!isEnabled())
+			return;
+		iterations_.fetch_add(1, std::memory_order_relaxed);
+		if (proposed)
+			proposals_.fetch_add(1, std::memory_order_relaxed);
+		if (accepted)
+			accepted_.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void setCurrentScore(double score)
+	{
+		currentScore_.store(score, std::memory_order_relaxed);
+	}
+
+	double getElapsed() const
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+	}
+
+	uint64_t getIterations() const
+	{
+		return iterations_;
+	}
+
+	// a single-line JSON object with the current values
+	std::string toJson() const
+	{
+		double elapsed = getElapsed();
+		uint64_t hits = cacheHits_, misses = cacheMisses_;
+		uint64_t iterations = iterations_, proposals = proposals_, accepted = accepted_;
+		std::string phases;
+		for (int i = 0; i < N_PHASES; ++i)
+			phases += str(boost::format("%s\"%s\": %.6f") % (i ? ", " : "") % METRICS_PHASE_NAMES[i] % (phaseNanos_[i] * 1e-9));
+		return str(boost::format("{\"elapsed_s\": %.6f, \"iterations\": %d, \"iterations_per_s\": %.3f, "
+								 "\"proposals\": %d, \"accepted\": %d, \"acceptance_rate\": %.6f, \"current_score\": %.17g, "
+								 "\"compute_score_calls\": %d, \"cache\": {\"hits\": %d, \"misses\": %d, \"hit_rate\": %.6f}, "
+								 "\"phases_s\": {%s}}") %
+				   elapsed % iterations % (elapsed > 0 ? iterations / elapsed : 0.0) %
+				   proposals % accepted % (proposals ? (double)accepted / proposals : 0.0) % currentScore_.load() %
+				   computeScoreCalls_.load() % hits % misses % (hits + misses ? (double)hits / (hits + misses) : 0.0) %
+				   phases);
+	}
+};
+
+Metrics metrics;
+
+/**
+ * Adds the wall-clock lifetime of the object to a phase of the global
+ * metrics, if they are enabled.
+ */
+class PhaseTimer
+{
+private:
+	MetricsPhase phase_;
+	bool enabled_;
+	std::chrono::steady_clock::time_point start_;
+
+public:
+	PhaseTimer(MetricsPhase phase) : phase_(phase), enabled_(metrics.isEnabled())
+	{
+		if (enabled_)
+			start_ = std::chrono::steady_clock::now();
+	}
+
+	~PhaseTimer()
+	{
+		if (enabled_)
+			metrics.addPhaseTime(phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+	}
+};
+
+#endif
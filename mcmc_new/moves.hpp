@@ -0,0 +1,97 @@
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+#include "common.hpp"
+
+#ifndef MOVES_HPP
+#define MOVES_HPP
+
+/**
+ * Proposals of order MCMC. The block move reorders swap_n random nodes by
+ * an exact DP over them; the others are cheap symmetric permutations whose
+ * proposal changes the predecessor sets of a contiguous range of positions
+ * only, so just those nodes have to be rescored.
+ */
+enum OrderMove
+{
+	MOVE_BLOCK,
+	MOVE_ADJACENT,
+	MOVE_TRANSPOSE,
+	MOVE_REINSERT,
+	N_MOVES
+};
+
+static const char *const ORDER_MOVE_NAMES[N_MOVES] = {"block", "adjacent", "transpose", "reinsert"};
+
+// parses a move mixture such as "adjacent=0.6,reinsert=0.3,block=0.1" into weights per move
+void parseMoveMixture(const std::string &spec, std::vector<double> &weights)
+{
+	weights.assign(N_MOVES, 0.0);
+	std::istringstream in(spec);
+	std::string item;
+	double total = 0;
+	while (std::getline(in, item, ','))
+	{
+		size_t eq = item.find('=');
+		std::string name = item.substr(0, eq);
+		int move = 0;
+		while (move < N_MOVES && name != ORDER_MOVE_NAMES[move])
+			++move;
+		if (move == N_MOVES)
+			throw Exception("Unknown move %s") % name;
+		double w = 1.0;
+		if (eq != std::string::npos)
+		{
+			char *end;
+			w = strtod(item.c_str() + eq + 1, &end);
+			if (*end != '\0' || !(w >= 0))
+				throw Exception("Invalid weight in %s") % item;
+		}
+		weights[move] += w;
+		total += w;
+	}
+	if (!(total > 0))
+		throw Exception("Move mixture %s has no positive weight") % spec;
+}
+
+// swaps the nodes at two neighbouring positions
+void adjacentTransposition(std::vector<int> &order, std::mt19937 &gen, int &from, int &to)
+{
+	std::uniform_int_distribution<> dis(0, order.size() - 2);
+	from = dis(gen);
+	to = from + 1;
+	std::swap(order[from], order[to]);
+}
+
+// swaps the nodes at two random positions
+void randomTransposition(std::vector<int> &order, std::mt19937 &gen, int &from, int &to)
+{
+	std::uniform_int_distribution<> dis(0, order.size() - 1);
+	from = dis(gen);
+	do
+		to = dis(gen);
+	while (to == from);
+	if (from > to)
+		std::swap(from, to);
+	std::swap(order[from], order[to]);
+}
+
+// moves the node at a random position to another random position
+void reinsertNode(std::vector<int> &order, std::mt19937 &gen, int &from, int &to)
+{
+	std::uniform_int_distribution<> dis(0, order.size() - 1);
+	int src = dis(gen), dst;
+	do
+		dst = dis(gen);
+	while (dst == src);
+	int node = order[src];
+	order.erase(order.begin() + src);
+	order.insert(order.begin() + dst, node);
+	from = src < dst ? src : dst;
+	to = src < dst ? dst : src;
+}
+
+#endif
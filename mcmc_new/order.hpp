@@ -6,9 +6,13 @@
 #include <list>
 #include <queue>
 #include <map>
+#include <memory>
 #include <iomanip>
 #include <utility>
 #include <algorithm>
+#include <random>
+#include <sstream>
+#include <functional>
 #include <time.h>
 #include <string.h>
 #include "common.hpp"
@@ -18,14 +22,24 @@
 #include "scores.hpp"
 #include "bestdagdp.hpp"
 #include "timer.hpp"
+#include "checkpoint.hpp"
+#include "scorecache.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "logger.hpp"
+#include "moves.hpp"
+#include "blockdp.hpp"
+#include "bitmatrix.hpp"
+#include "samplesink.hpp"
+
+#ifndef ORDER_HPP
+#define ORDER_HPP
 
 using namespace std;
 
-void generateTargets(vector<int> &swap_targets, vector<int> &order, map<int, int> &m, int n)
+void generateTargets(vector<int> &swap_targets, vector<int> &order, map<int, int> &m, int n, std::mt19937 &gen)
 {
 	vector<int> temp;
-	random_device rd;
-	std::mt19937 gen(rd());
 	uniform_int_distribution<> dis(0, n - 1);
 	int flag;
 	do
@@ -59,72 +73,96 @@ void generateTargets(vector<int> &swap_targets, vector<int> &order, map<int, int
 		swap_targets[i] = iter->first;
 	}
 }
-double compute(DataColumns &datacolumns, vector<int> &order, const ScoreFun *scoreFun, int maxParentSize)
+// sum of the local scores of the node at position i over the parent sets drawn from its predecessors
+double nodeScore(LocalScoreCache &localScores, const vector<int> &order, int i, int maxParentSize)
 {
 	int n = order.size();
-	double scores = 1;
 	StackSubset parents(n);
 	maxParentSize = n < maxParentSize ? n : maxParentSize;
-	for (int i = 0; i < n; ++i)
+	int node = order[i];
+	double score = 0.0;
+	for (int j = 0; j <= maxParentSize; ++j)
 	{
-		int node = order[i];
-		double score = 0.0;
-		for (int j = 0; j <= maxParentSize; ++j)
+		vector<int> pa(i);
+		int predn = i;
+		parents.clear();
+		if (j > predn)
+			break;
+		for (int k = 0; k < j; ++k)
+			pa[k] = 1;
+		bool bFind = false;
+		do
 		{
-			vector<int> pa(i);
-			int predn = i;
-			parents.clear();
-			if (j > predn)
-				break;
-			for (int k = 0; k < j; ++k)
-				pa[k] = 1;
-			bool bFind = false;
-			do
+			for (int k = 0; k < predn; ++k)
 			{
-				// getchar();
-				// cout<<"node: "<<node<<" parents: ";
-				for (int k = 0; k < predn; ++k)
+				if (pa[k])
 				{
-					if (pa[k])
-					{
-						// cout<<order[k]<<" ";
-						parents.push(order[k]);
-					}
+					parents.push(order[k]);
 				}
-				// cout<<endl;
-				bFind = false;
-				// score=1;
-				score += computeScore(&datacolumns, parents, node, scoreFun);
-				// cout <<"score: "<< score << endl;
-				parents.clear();
-				for (int k = 0; k < predn - 1; ++k)
+			}
+			bFind = false;
+			score += localScores(parents, node);
+			parents.clear();
+			for (int k = 0; k < predn - 1; ++k)
+			{
+				if (pa[k] && !pa[k + 1])
 				{
-					if (pa[k] && !pa[k + 1])
+					swap(pa[k], pa[k + 1]);
+					bFind = true;
+					if (!pa[0])
 					{
-						swap(pa[k], pa[k + 1]);
-						bFind = true;
-						if (!pa[0])
+						for (int a = 0, b = 0; a < k; ++a)
 						{
-							for (int a = 0, b = 0; a < k; ++a)
+							if (pa[a])
 							{
-								if (pa[a])
-								{
-									swap(pa[a], pa[b]);
-									b++;
-								}
+								swap(pa[a], pa[b]);
+								b++;
 							}
 						}
-						break;
 					}
+					break;
 				}
-			} while (bFind);
-		}
-		scores *= score;
+			}
+		} while (bFind);
 	}
+	return score;
+}
+double compute(LocalScoreCache &localScores, vector<int> &order, int maxParentSize)
+{
+	PhaseTimer timer(PHASE_ORDER_SCORING);
+	TraceSpan span("order_scoring");
+	int n = order.size();
+	double scores = 0;
+	for (int i = 0; i < n; ++i)
+		scores += nodeScore(localScores, order, i, maxParentSize);
 	return scores;
 }
+
+// an order together with the score of every position given its predecessors
+struct OrderChain
+{
+	vector<int> order;
+	vector<double> nodeScores;
+	double score; // log score, the sum of nodeScores
+};
+
+// rescores the positions from..to, whose predecessor sets changed, and updates the order score
+void rescoreOrder(LocalScoreCache &localScores, OrderChain &chain, int from, int to, int maxParentSize)
+{
+	PhaseTimer timer(PHASE_ORDER_SCORING);
+	TraceSpan span("order_scoring");
+	int n = chain.order.size();
+	chain.nodeScores.resize(n);
+	for (int i = from; i <= to; ++i)
+		chain.nodeScores[i] = nodeScore(localScores, chain.order, i, maxParentSize);
+	chain.score = 0;
+	for (int i = 0; i < n; ++i)
+		chain.score += chain.nodeScores[i];
+}
 void findPartialOrder(Data &data, vector<int> &targets, vector<int> &order, const ScoreFun *scoreFun, int localMaxIndegree)
 {
+	PhaseTimer timer(PHASE_BLOCK_DP);
+	TraceSpan span("block_dp");
 	int nVariables = data.nVariables;
 	DataColumns dataColumns(data, targets);
 	list<int> order_list;
@@ -138,9 +176,11 @@ void findPartialOrder(Data &data, vector<int> &targets, vector<int> &order, cons
 	}
 	// cout<<endl;
 }
-void order2dag(DataView &data, vector<int> &order, const ScoreFun *scoreFun, int maxParentSize, SquareMat<bool> &dag)
+void order2dag(LocalScoreCache &localScores, vector<int> &order, int maxParentSize, BitMatrix &dag)
 {
-	int n = data.getNumVariables();
+	PhaseTimer timer(PHASE_ORDER2DAG);
+	TraceSpan span("order2dag");
+	int n = localScores.getNumVariables();
 	StackSubset parents(n);
 	maxParentSize = n < maxParentSize ? n : maxParentSize;
 	StackSubset best_parents(n);
@@ -173,7 +213,7 @@ void order2dag(DataView &data, vector<int> &order, const ScoreFun *scoreFun, int
 				}
 				// cout<<endl;
 				// score=1;
-				double current_score = computeScore(&data, parents, node, scoreFun);
+				double current_score = localScores(parents, node);
 				// cout<<"current_score:"<<current_score<<" best_score"<<best_score<<endl;
 				if (current_score > best_score)
 				{
@@ -213,7 +253,7 @@ void order2dag(DataView &data, vector<int> &order, const ScoreFun *scoreFun, int
 			int p = best_parents.pop();
 			// cout<<p<<" ";
 			// pa_outfile << p << " ";
-			dag(p, node) = 1;
+			dag.set(p, node);
 		}
 		// cout<<endl;
 		// pa_outfile << endl;
@@ -223,6 +263,38 @@ void order2dag(DataView &data, vector<int> &order, const ScoreFun *scoreFun, int
 	// 	pa_outfile.close();
 	// }
 }
+// order2dag over pruned candidate parent sets: the first candidate of each node whose parents all precede it
+void order2dag(const CandidateParentSets &candidates, vector<int> &order, BitMatrix &dag)
+{
+	PhaseTimer timer(PHASE_ORDER2DAG);
+	TraceSpan span("order2dag");
+	int n = order.size();
+	uint64_t allowed = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		int node = order[i];
+		for (uint64_t pa = candidates.best(node, allowed).parents; pa; pa &= pa - 1)
+			dag.set(__builtin_ctzll(pa), node);
+		allowed |= (uint64_t)1 << node;
+	}
+}
+// sum of the log local scores of the nodes of dag with their parents
+double dagLogScore(LocalScoreCache &localScores, const BitMatrix &dag)
+{
+	int n = dag.getNumNodes();
+	StackSubset parents(n);
+	double score = 0;
+	for (int j = 0; j < n; ++j)
+	{
+		parents.clear();
+		const uint64_t *row = dag.getParents(j);
+		for (int w = 0; w < dag.getNumWords(); ++w)
+			for (uint64_t bits = row[w]; bits; bits &= bits - 1)
+				parents.push(w * 64 + __builtin_ctzll(bits));
+		score += localScores(parents, j);
+	}
+	return score;
+}
 // bool cmp(const pair<vector<int>, int> &a, const pair<vector<int>, int> &b)
 // {
 // 	return a.second > b.second;
@@ -241,139 +313,444 @@ double c(int n,int m)
 	{
 		deno*=i;
 	}
-	cout<<nomi<<" "<<deno<<endl;
+	logger.printfln(3, "c(%d, %d) = %ld / %ld", n, m, deno, nomi);
 	return  (double)deno/(double)nomi;
 }
-void myMCMC(Data &data, vector<int> &targets, int burn_in = 1000, int maxParentSize = 3, int swap_n = 5)
+// writes the fraction of the samples containing each edge i --> j
+void writeEdgeFrequencies(const char *path, const SquareMat<int> &res, int sample_count)
+{
+	int n = res.getNumNodes();
+	ofstream result_outfile;
+	result_outfile.open(path, ios::out | ios::trunc);
+	for (int i = 0; i < n; ++i)
+	{
+		for (int j = 0; j < n; ++j)
+		{
+			result_outfile << i << " --> " << j << " " << setprecision(3) << setiosflags(ios::fixed) << (double)res(i, j) / (double)sample_count << endl;
+		}
+	}
+	if (result_outfile.is_open())
+	{
+		result_outfile.close();
+	}
+}
+
+struct MCMCOptions
+{
+	int burnIn;
+	int maxParentSize;
+	int swapN;
+	unsigned int seed;			// 0 draws a seed from std::random_device
+	std::string checkpointFile; // empty disables checkpointing
+	int checkpointInterval;		// iterations between two checkpoints
+	bool resume;				// continue from checkpointFile
+	std::string scoreStore;		// directory of persistent local score stores, empty disables
+	std::string metricsFile;	// JSON summary of the run metrics, empty disables
+	std::string metricsLog;		// periodic JSON lines of the run metrics, empty disables
+	int metricsInterval;		// iterations between two metrics lines
+	bool pruneParents;			// sample DAGs from pruned candidate parent sets
+	vector<double> moveWeights; // relative frequency of each OrderMove
+	int replicas;				// number of tempered chains, 1 for plain order MCMC
+	int swapInterval;			// iterations between two replica exchanges
+	std::string samplesFile;	// every retained order and DAG, empty disables
+	size_t blockMemoSize;		// block move target sets whose best order is remembered
+	std::function<void(int, int)> progress; // called with (iterations done, burnIn) at every sample, may be empty; throwing abandons the run
+	bool fastLogAdd;			// sum scores in log space with FastLogAdd instead of ExactLogAdd
+
+	MCMCOptions()
+		: burnIn(1000), maxParentSize(3), swapN(5), seed(0), checkpointInterval(100), resume(false), metricsInterval(100),
+		  pruneParents(false), moveWeights(N_MOVES, 0.0), replicas(1), swapInterval(10),
+		  blockMemoSize(65536), fastLogAdd(false)
+	{
+		moveWeights[MOVE_BLOCK] = 1.0;
+	}
+};
+
+// shares the BDeu scores of localScores with other runs through the store in dir
+void attachScoreStore(LocalScoreCache &localScores, Data &data, vector<int> &targets, const std::string &dir,
+					  double equivalentSampleSize)
+{
+	ScoreStoreKey key;
+	key.dataHash = hashData(data, targets);
+	key.scoreName = "BDeu";
+	key.ess = equivalentSampleSize;
+	key.maxParents = localScores.getMaxParents();
+	size_t nStored = localScores.attachStore(dir, key);
+	cout << "score store: " << localScores.getStore()->getPath() << " (" << nStored << " scores)" << endl;
+}
+
+// closes the sample file and prints how many samples it received
+void reportSampleSink(SampleSink &sink)
+{
+	bool ok = sink.close();
+	cout << "samples written to " << sink.getPath() << ": " << sink.getNumWritten();
+	if (sink.getNumKept())
+		cout << " after " << sink.getNumKept() << " of the resumed run";
+	if (sink.getNumDropped())
+		cout << " (" << sink.getNumDropped() << " dropped)";
+	cout << endl;
+	if (!ok)
+		cout << "could not write " << sink.getPath() << endl;
+}
+
+void saveChainState(ChainState &state, const vector<int> &order, double x, int temp, int sample_count,
+					const SquareMat<int> &res, const std::mt19937 &gen, double elapsed, SampleSink *sampleSink)
+{
+	int n = order.size();
+	state.nSamples = sampleSink ? sampleSink->sync() : 0;
+	state.order = order;
+	state.score = x;
+	state.remaining = temp;
+	state.sampleCount = sample_count;
+	state.elapsed = elapsed;
+	state.edgeCounts.resize(n * n);
+	for (int i = 0; i < n; ++i)
+		for (int j = 0; j < n; ++j)
+			state.edgeCounts[i * n + j] = res(i, j);
+	std::ostringstream rngStream;
+	rngStream << gen;
+	state.rngState = rngStream.str();
+}
+
+/**
+ * Draws proposals of an order chain from the move mixture of the options.
+ * Scores are log scores, so a proposal of log score y from a chain at x is
+ * accepted if log u < y - x + logHastings. The local moves are symmetric;
+ * the block move contributes log c(n, swap_n) as its Hastings term, which
+ * never becomes part of the chain's score.
+ */
+class OrderProposer
+{
+private:
+	Data &data_;
+	LocalScoreCache &localScores_;
+	const ScoreFun *scoreFun_;
+	int maxParentSize_;
+	int swapN_;
+	vector<double> weights_;
+	int nMoveKinds_;
+	std::discrete_distribution<> moveDis_;
+	BlockDP blockDP_;
+
+public:
+	OrderProposer(Data &data, LocalScoreCache &localScores, const ScoreFun *scoreFun, const MCMCOptions &options)
+		: data_(data), localScores_(localScores), scoreFun_(scoreFun), maxParentSize_(options.maxParentSize),
+		  swapN_(options.swapN), weights_(options.moveWeights), nMoveKinds_(0),
+		  moveDis_(options.moveWeights.begin(), options.moveWeights.end()),
+		  blockDP_(localScores, options.maxParentSize, options.blockMemoSize)
+	{
+		for (int k = 0; k < N_MOVES; ++k)
+			if (weights_[k] > 0)
+				++nMoveKinds_;
+	}
+
+	int getNumMoveKinds() const
+	{
+		return nMoveKinds_;
+	}
+
+	const BlockDP &getBlockDP() const
+	{
+		return blockDP_;
+	}
+
+	// fills proposal with a move from chain and returns its log score y; move receives the kind of move
+	double propose(const OrderChain &chain, OrderChain &proposal, int &move, double &logHastings, std::mt19937 &gen)
+	{
+		int n = chain.order.size();
+		// a single kind of move is used without drawing, which keeps the random stream of block-only runs
+		move = 0;
+		if (nMoveKinds_ > 1)
+			move = moveDis_(gen);
+		else
+			while (weights_[move] == 0)
+				++move;
+		proposal.order = chain.order;
+		proposal.nodeScores = chain.nodeScores;
+		if (move == MOVE_BLOCK)
+		{
+			vector<int> &new_order = proposal.order;
+			vector<int> swap_targets(swapN_);
+			vector<int> swap_orders;
+			map<int, int> m;
+			generateTargets(swap_targets, new_order, m, n, gen);
+			blockDP_.findBestOrder(swap_targets, swap_orders);
+			int from = n, to = -1;
+			for (int i = 0; i < swap_orders.size(); ++i)
+			{
+				map<int, int>::iterator mit = m.find(swap_targets[i]);
+				new_order[mit->second] = swap_orders[i];
+				if (mit->second < from)
+					from = mit->second;
+				if (mit->second > to)
+					to = mit->second;
+			}
+			rescoreOrder(localScores_, proposal, from, to, maxParentSize_);
+			logHastings = log(c(n, swapN_));
+			return proposal.score;
+		}
+		int from, to;
+		if (move == MOVE_ADJACENT)
+			adjacentTransposition(proposal.order, gen, from, to);
+		else if (move == MOVE_TRANSPOSE)
+			randomTransposition(proposal.order, gen, from, to);
+		else
+			reinsertNode(proposal.order, gen, from, to);
+		rescoreOrder(localScores_, proposal, from, to, maxParentSize_);
+		logHastings = 0;
+		return proposal.score;
+	}
+};
+
+// outcome of an order MCMC run
+struct OrderMCMCResult
+{
+	SquareMat<int> edgeCounts; // number of samples containing each edge i --> j
+	int sampleCount;
+	vector<int> order; // last state of the chain
+	double score;	  // log score of order
+	double elapsed;	// seconds, including the runs before a resume
+	uint64_t moveProposed[N_MOVES];
+	uint64_t moveAccepted[N_MOVES];
+	uint64_t blockLookups; // block move target sets looked up in the memo
+	uint64_t blockHits;
+
+	OrderMCMCResult(int n) : edgeCounts(n), sampleCount(0), score(0), elapsed(0), blockLookups(0), blockHits(0)
+	{
+		edgeCounts.setAll(0);
+		for (int k = 0; k < N_MOVES; ++k)
+			moveProposed[k] = moveAccepted[k] = 0;
+	}
+
+	// fraction of the samples containing the edge i --> j
+	double getEdgePosterior(int i, int j) const
+	{
+		return sampleCount ? (double)edgeCounts(i, j) / (double)sampleCount : 0.0;
+	}
+
+	void getEdgePosteriors(SquareMat<double> &posteriors) const
+	{
+		int n = edgeCounts.getNumNodes();
+		for (int i = 0; i < n; ++i)
+			for (int j = 0; j < n; ++j)
+				posteriors(i, j) = getEdgePosterior(i, j);
+	}
+};
+
+/**
+ * Runs a single order chain over the variables of localScores and samples
+ * a DAG every 10 iterations; targets are the columns of data it runs on,
+ * which checkpoints record a hash of. The chain starts from the identity
+ * order (or the checkpoint with options.resume); DAGs come from candidates
+ * when it is not NULL. Checkpoints, sample files and metrics are written as
+ * the options ask, but no result file: the edge counts are left in result.
+ * The global metrics are added to, not reset, so runs of several sessions
+ * at once do not wipe each other's counters.
+ */
+void runOrderMCMC(Data &data, const vector<int> &targets, LocalScoreCache &localScores,
+				  const CandidateParentSets *candidates, const MCMCOptions &options, OrderMCMCResult &result)
 {
 	Timer timer;
-	double equivalentSampleSize = 1;
-	int n = targets.size();
-	vector<int> order(targets);
-	ScoreFun *scoreFun = new BDeuScore(equivalentSampleSize);
-	random_device rd;
-	std::mt19937 gen(rd());
-	DataColumns datacolumns(data, targets);
+	int burn_in = options.burnIn;
+	int maxParentSize = options.maxParentSize;
+	int swap_n = options.swapN;
+	int n = localScores.getNumVariables();
+	vector<int> order(n);
+	for (int i = 0; i < n; ++i)
+		order[i] = i;
+	std::mt19937 gen(options.seed);
+	if (options.seed == 0)
+	{
+		random_device rd;
+		gen.seed(rd());
+	}
+	int nMoveKinds = 0;
+	for (int k = 0; k < N_MOVES; ++k)
+		if (options.moveWeights[k] > 0)
+			++nMoveKinds;
+	if (n < 2 && nMoveKinds > (options.moveWeights[MOVE_BLOCK] > 0 ? 1 : 0))
+		throw Exception("Local moves need at least two variables");
 	std::uniform_real_distribution<double> dis(0.0, 1.0);
-	ofstream outfile;
-	ofstream result_outfile;
-	// outfile.open("order.dat", ios::out | ios::trunc);
 	int temp = burn_in;
-	SquareMat<int> res(n);
-	SquareMat<bool> dag(n);
+	SquareMat<int> &res = result.edgeCounts;
+	BitMatrix dag(n);
 	res.setAll(0);
 	int sample_count = 0;
-	double x = compute(datacolumns, order, scoreFun, maxParentSize);
+	double x;
+	double elapsedBefore = 0.0;
+	ChainState state;
+	state.nVariables = n;
+	state.burnIn = burn_in;
+	state.maxParentSize = maxParentSize;
+	state.swapN = swap_n;
+	state.dataHash = options.checkpointFile.empty() ? 0 : hashData(data, targets);
+	state.moveWeights = options.moveWeights;
+	if (options.resume)
+	{
+		ChainState saved;
+		readChainState(options.checkpointFile, saved);
+		if (saved.nVariables != n || saved.burnIn != burn_in || saved.maxParentSize != maxParentSize || saved.swapN != swap_n ||
+			saved.moveWeights != state.moveWeights)
+			throw Exception("Checkpoint %s was written with different settings") % options.checkpointFile;
+		if (saved.dataHash != state.dataHash)
+			throw Exception("Checkpoint %s was written for different data") % options.checkpointFile;
+		state = saved;
+		order = state.order;
+		x = state.score;
+		temp = state.remaining;
+		sample_count = state.sampleCount;
+		elapsedBefore = state.elapsed;
+		for (int i = 0; i < n; ++i)
+			for (int j = 0; j < n; ++j)
+				res(i, j) = state.edgeCounts[i * n + j];
+		std::istringstream rngStream(state.rngState);
+		rngStream >> gen;
+	}
+	OrderChain chain;
+	chain.order = order;
+	{
+		TraceSpan span("initial_scoring");
+		rescoreOrder(localScores, chain, 0, n - 1, maxParentSize);
+	}
+	if (!options.resume)
+		x = chain.score;
+	ofstream metricsLog;
+	if (!options.metricsLog.empty())
+		metricsLog.open(options.metricsLog.c_str(), ios::out | ios::app);
+	metrics.setCurrentScore(x);
+	// released also when options.progress throws to abandon the run
+	std::unique_ptr<CheckpointWriter> checkpointWriter;
+	if (!options.checkpointFile.empty())
+		checkpointWriter.reset(new CheckpointWriter(options.checkpointFile));
+	std::unique_ptr<SampleSink> sampleSink;
+	if (!options.samplesFile.empty())
+	{
+		sampleSink.reset(new SampleSink(options.samplesFile, n, options.resume ? state.nSamples : 0));
+		if (sampleSink->getNumLost())
+			cout << "samples: " << options.samplesFile << " lacks " << sampleSink->getNumLost()
+				 << " samples of the checkpoint, continuing after the " << sampleSink->getNumKept() << " it has" << endl;
+	}
 	timer.start();
+	OrderChain proposal = chain;
+	OrderProposer proposer(data, localScores, localScores.getScoreFun(), options);
 	while (temp--)
 	{
-		vector<int> new_order = order;
-		vector<int> swap_targets(swap_n);
-		vector<int> swap_orders;
-		map<int, int> m;
-		generateTargets(swap_targets, new_order, m, n);
-		// std::cout<<"swap targets:"<<endl;
-		// for(int i=0;i<swap_targets.size();++i)
-		// 	std::cout<<swap_targets[i]<<" ";
-		// std::cout<<endl;
-		// vector<int> temp;
-		// for (int i = 0; i < swap_targets.size(); ++i)
-		// {
-		// 	temp.push_back(order[swap_targets[i]]);
-		// }
-		// std::cout<<"temp:"<<endl;
-		// for(int i=0;i<temp.size();++i)
-		// 	std::cout<<temp[i]<<" ";
-		// std::cout<<endl;
-		findPartialOrder(data, swap_targets, swap_orders, scoreFun, maxParentSize);
-		// std::cout<<"swap orders:"<<endl;
-		// for(int i=0;i<swap_orders.size();++i)
-		// 	std::cout<<swap_orders[i]<<" ";
-		// std::cout<<endl;
-		map<int, int>::iterator mit;
-		// cout<<"m:"<<endl;
-		// for(mit = m.begin();mit!=m.end();++mit)
-		// {
-		// 	cout<<mit->first<<" "<<mit->second<<endl;
-		// }
-		for (int i = 0; i < swap_orders.size(); ++i)
+		TraceSpan span("mcmc_iteration");
+		int move;
+		double logHastings;
+		double y = proposer.propose(chain, proposal, move, logHastings, gen);
+		bool accept = log(dis(gen)) < y - x + logHastings;
+		++result.moveProposed[move];
+		if (accept)
 		{
-			map<int, int>::iterator mit = m.find(swap_targets[i]);
-			new_order[mit->second] = swap_orders[i];
+			++result.moveAccepted[move];
+			chain.order.swap(proposal.order);
+			chain.nodeScores.swap(proposal.nodeScores);
+			chain.score = proposal.score;
+			x = y;
 		}
-		// swap(new_order[a], new_order[b]);
-		// std::cout << "order:"<<endl;
-		// for (int i = 0; i < n; ++i)
-		// 	std::cout << order[i] << ' ';
-		// std::cout << endl;
-		// std::cout << "new order:"<<endl;
-		// for (int i = 0; i < n; ++i)
-		// 	std::cout << new_order[i] << ' ';
-		// std::cout << endl;
-
-		// timer.start();
-		// double x = compute(datacolumns, order, scoreFun, maxParentSize);
-		// std::cout << timer.elapsed() << endl;
-		// getchar();
-		double y = compute(datacolumns, new_order, scoreFun, maxParentSize)*c(n,swap_n);
-		// cout << x << " " << y << endl;
-		// cout<<"y/x:"<<y/x<<std::endl;
-		double alpha = (y / x) < 1.0 ? y / x : 1.0;
-		double beta = dis(gen);
-		// std::cout << alpha << " " << beta << std::endl;
-		if (alpha > beta)
+		vector<int> &order = chain.order;
+		metrics.countIteration(true, accept);
+		metrics.setCurrentScore(x);
+		if (metricsLog.is_open() && (burn_in - temp) % options.metricsInterval == 0)
 		{
-			order = new_order;
-			x = y;
+			metrics.setCacheStats(localScores.getNumHits(), localScores.getNumComputed());
+			metricsLog << metrics.toJson() << endl;
 		}
-		// for (int i = 0; i < n; ++i)
-		// {
-		// 	outfile << order[i] << ' ';
-		// }
-		// outfile << endl;
 		if (temp % 10 == 0)
 		{
-			cout<<"temp: "<<temp<<endl;
+			logger.progress(1, "temp: %d", temp);
+			if (options.progress)
+				options.progress(burn_in - temp, burn_in);
 			sample_count++;
-			dag.setAll(false);
-			order2dag(data, order, scoreFun, maxParentSize, dag);
-			for (int i = 0; i < n; ++i)
-			{
-				for (int j = 0; j < n; ++j)
-				{
-					if (dag(i, j))
-					{
-						res(i, j)++;
-					}
-				}
-			}
+			dag.clearAll();
+			if (candidates)
+				order2dag(*candidates, order, dag);
+			else
+				order2dag(localScores, order, maxParentSize, dag);
+			dag.addTo(res);
+			if (sampleSink)
+				sampleSink->push(order, dag, dagLogScore(localScores, dag));
 		}
-		// std::cout << "--------------" << endl;
-		// getchar();
-	}
-	// if (outfile.is_open())
-	// {
-	// 	outfile.close();
-	// }
-	// cout<<"most_frequent_order:";
-	// for(int i=0;i<most_frequent_order.size();++i)
-	// {
-	// 	cout<<most_frequent_order[i]<<" ";
-	// }
-	// cout<<endl;
-	// cout << "times:" << v4sort[0].second << endl;
-	cout << "sample count: " << sample_count << endl;
-	cout << "time elapsed: " << timer.elapsed() << endl;
-	result_outfile.open("result.dat", ios::out | ios::trunc);
-	for (int i = 0; i < n; ++i)
-	{
-		for (int j = 0; j < n; ++j)
+		if (checkpointWriter && (burn_in - temp) % options.checkpointInterval == 0)
 		{
-			result_outfile << i << " --> " << j << " " << setprecision(3) << setiosflags(ios::fixed) << (double)res(i, j) / (double)sample_count << endl;
+			saveChainState(state, order, x, temp, sample_count, res, gen, elapsedBefore + timer.elapsed(), sampleSink.get());
+			checkpointWriter->submit(state);
 		}
 	}
-	if (result_outfile.is_open())
+	order = chain.order;
+	if (checkpointWriter)
 	{
-		result_outfile.close();
+		saveChainState(state, order, x, temp < 0 ? 0 : temp, sample_count, res, gen, elapsedBefore + timer.elapsed(), sampleSink.get());
+		checkpointWriter->submit(state);
+		checkpointWriter.reset();
+	}
+	if (sampleSink)
+	{
+		reportSampleSink(*sampleSink);
+		sampleSink.reset();
+	}
+	metrics.setCacheStats(localScores.getNumHits(), localScores.getNumComputed());
+	if (!options.metricsFile.empty())
+	{
+		ofstream metricsOut(options.metricsFile.c_str(), ios::out | ios::trunc);
+		metricsOut << metrics.toJson() << endl;
+	}
+	result.sampleCount = sample_count;
+	result.order = order;
+	result.score = x;
+	result.blockLookups = proposer.getBlockDP().getNumLookups();
+	result.blockHits = proposer.getBlockDP().getNumHits();
+	result.elapsed = elapsedBefore + timer.elapsed();
+}
+
+void myMCMC(Data &data, vector<int> &targets, const MCMCOptions &options)
+{
+	double equivalentSampleSize = 1;
+	int maxParentSize = options.maxParentSize;
+	int n = targets.size();
+	BDeuScore scoreFun(equivalentSampleSize);
+	DataColumns datacolumns(data, targets);
+	LocalScoreCache localScores(datacolumns, &scoreFun, maxParentSize);
+	if (!options.scoreStore.empty())
+		attachScoreStore(localScores, data, targets, options.scoreStore, equivalentSampleSize);
+	CandidateParentSets candidates(n);
+	if (options.pruneParents)
+	{
+		PruningStats pruningStats;
+		pruneParentSets(datacolumns, maxParentSize, &scoreFun, candidates, &pruningStats);
+		printPruningStats(cout, pruningStats);
+	}
+	OrderMCMCResult result(n);
+	metrics.reset();
+	runOrderMCMC(data, targets, localScores, options.pruneParents ? &candidates : NULL, options, result);
+	int nMoveKinds = 0;
+	for (int k = 0; k < N_MOVES; ++k)
+		if (options.moveWeights[k] > 0)
+			++nMoveKinds;
+	if (nMoveKinds > 1)
+	{
+		for (int k = 0; k < N_MOVES; ++k)
+			if (result.moveProposed[k])
+				cout << ORDER_MOVE_NAMES[k] << " moves: " << result.moveAccepted[k] << " of " << result.moveProposed[k]
+					 << " accepted" << endl;
 	}
+	if (result.blockLookups > 0)
+		cout << "block orders: " << result.blockHits << " of " << result.blockLookups << " from memo" << endl;
+	cout << "sample count: " << result.sampleCount << endl;
+	cout << "time elapsed: " << result.elapsed << endl;
+	writeEdgeFrequencies("result.dat", result.edgeCounts, result.sampleCount);
+	if (!localScores.save())
+		cout << "could not write score store " << localScores.getStore()->getPath() << endl;
 }
+
+void myMCMC(Data &data, vector<int> &targets, int burn_in = 1000, int maxParentSize = 3, int swap_n = 5)
+{
+	MCMCOptions options;
+	options.burnIn = burn_in;
+	options.maxParentSize = maxParentSize;
+	options.swapN = swap_n;
+	myMCMC(data, targets, options);
+}
+
+#endif
@@ -0,0 +1,237 @@
+#include <ostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <stdint.h>
+
+#include "common.hpp"
+#include "data.hpp"
+#include "stacksubset.hpp"
+#include "scores.hpp"
+#include "subsetrank.hpp"
+#include "metrics.hpp"
+
+#ifndef PRUNING_HPP
+#define PRUNING_HPP
+
+/**
+ * The parent sets of each node that may be optimal for some set of allowed
+ * parents, sorted by decreasing score. The empty set is always a candidate,
+ * so every query has an answer.
+ */
+class CandidateParentSets
+{
+public:
+	struct Candidate
+	{
+		double score;
+		uint64_t parents;
+	};
+
+private:
+	struct ByScore
+	{
+		bool operator()(const Candidate &a, const Candidate &b) const
+		{
+			return a.score > b.score || (!(b.score > a.score) && a.parents < b.parents);
+		}
+	};
+
+	std::vector<std::vector<Candidate> > sets_;
+
+public:
+	CandidateParentSets(int n) : sets_(n) {}
+
+	int getNumNodes() const
+	{
+		return sets_.size();
+	}
+
+	void add(int node, uint64_t parents, double score)
+	{
+		Candidate c = {score, parents};
+		sets_[node].push_back(c);
+	}
+
+	// restores the score order after adding
+	void sort()
+	{
+		for (size_t i = 0; i < sets_.size(); ++i)
+			std::sort(sets_[i].begin(), sets_[i].end(), ByScore());
+	}
+
+	const std::vector<Candidate> &operator()(int node) const
+	{
+		return sets_[node];
+	}
+
+	// best candidate of node whose parents are all in allowed
+	const Candidate &best(int node, uint64_t allowed) const
+	{
+		const std::vector<Candidate> &c = sets_[node];
+		for (size_t k = 0; k < c.size(); ++k)
+			if ((c[k].parents & ~allowed) == 0)
+				return c[k];
+		throw Exception("No candidate parent set of node %d") % node;
+	}
+
+	size_t size() const
+	{
+		size_t total = 0;
+		for (size_t i = 0; i < sets_.size(); ++i)
+			total += sets_[i].size();
+		return total;
+	}
+};
+
+struct PruningStats
+{
+	uint64_t total;		 // parent sets within the size limit
+	uint64_t scored;	 // sets that had to be counted and scored
+	uint64_t bounded;	 // sets eliminated by a score bound without scoring
+	uint64_t dominated;	 // scored sets no better than one of their subsets
+	uint64_t candidates; // sets kept
+	double seconds;		 // wall time of the pruning stage
+	double savedSeconds; // estimated scoring time of the bounded sets
+};
+
+// computeScore that also returns the number of parent configurations seen in the data
+double computeScoreAndSupport(const DataView *dataView, const StackSubset &parents, int node, const ScoreFun *scoreFun,
+							  int &nNonzero)
+{
+	std::vector<int> vars(parents.size() + 1);
+	for (size_t i = 0; i < parents.size(); ++i)
+		vars[i] = parents[i];
+	vars[parents.size()] = node;
+	metrics.countComputeScore();
+	int *counts;
+	{
+		PhaseTimer timer(PHASE_COUNTING);
+		counts = dataView->getCounts(vars);
+	}
+	int nParentValues = 1;
+	for (size_t i = 0; i < parents.size(); ++i)
+		nParentValues *= dataView->getArity(parents[i]);
+	int nNodeValues = dataView->getArity(node);
+	double score;
+	{
+		PhaseTimer timer(PHASE_SCORING);
+		score = scoreFun->compute(nNodeValues, nParentValues, counts);
+	}
+	nNonzero = 0;
+	for (int pv = 0; pv < nParentValues; ++pv)
+	{
+		int k = 0;
+		while (k < nNodeValues && counts[pv * nNodeValues + k] == 0)
+			++k;
+		if (k < nNodeValues)
+			++nNonzero;
+	}
+	delete[] counts;
+	return score;
+}
+
+/**
+ * Computes the candidate parent sets of every node, visiting the parent
+ * sets of at most maxParents elements from small to large.
+ *
+ * A set T is eliminated without counting when the score bound of T (from
+ * its number of parent configurations and the largest support among its
+ * subsets) is no higher than the best score of a subset; as the bound does
+ * not increase for supersets, all supersets of T are eliminated with it.
+ * A scored set is dropped if some subset scores at least as high. Neither
+ * rule removes a set that is the unique best choice for any set of allowed
+ * parents, so exact searches over the candidates find optimal DAGs.
+ */
+void pruneParentSets(const DataView &data, int maxParents, const ScoreFun *scoreFun, CandidateParentSets &candidates,
+					 PruningStats *stats = NULL)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int n = data.getNumVariables();
+	if (n >= 64)
+		throw Exception("Parent set pruning supports at most 63 variables, the data has %d") % n;
+	SubsetRanker ranker(n, maxParents < n - 1 ? maxParents : n - 1);
+	size_t nSets = ranker.getNumSubsets();
+	const double inf = std::numeric_limits<double>::infinity();
+	std::vector<double> score(nSets), bestBelow(nSets);
+	std::vector<int> support(nSets); // number of non-empty parent configurations, or a lower bound
+	std::vector<char> dead(nSets);	 // eliminated together with all supersets
+	StackSubset parents(n);
+	PruningStats st = {0, 0, 0, 0, 0, 0, 0};
+	double scoringSeconds = 0;
+
+	for (int node = 0; node < n; ++node)
+	{
+		uint64_t nodeBit = (uint64_t)1 << node;
+		for (int size = 0; size <= ranker.getMaxSize(); ++size)
+		{
+			size_t offset = ranker.getSizeOffset(size);
+			size_t layerSize = ranker.binom(n, size);
+			uint64_t ss = ((uint64_t)1 << size) - 1;
+			for (size_t r = 0; r < layerSize; ++r)
+			{
+				size_t idx = offset + r;
+				score[idx] = -inf;
+				bestBelow[idx] = -inf;
+				support[idx] = 0;
+				dead[idx] = (ss & nodeBit) != 0;
+				if (!dead[idx])
+				{
+					++st.total;
+					int nParentValues = 1;
+					for (uint64_t rest = ss; rest && !dead[idx]; rest &= rest - 1)
+					{
+						int v = __builtin_ctzll(rest);
+						nParentValues *= data.getArity(v);
+						size_t sub = ranker.rankMask(ss & ~((uint64_t)1 << v));
+						if (dead[sub])
+							dead[idx] = true;
+						bestBelow[idx] = std::max(bestBelow[idx], std::max(bestBelow[sub], score[sub]));
+						support[idx] = std::max(support[idx], support[sub]);
+					}
+					if (dead[idx] || (size > 0 && scoreFun->upperBound(data.getArity(node), nParentValues, support[idx]) <= bestBelow[idx]))
+					{
+						dead[idx] = true;
+						++st.bounded;
+					}
+					else
+					{
+						parents.clear();
+						for (uint64_t rest = ss; rest; rest &= rest - 1)
+							parents.push(__builtin_ctzll(rest));
+						std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+						score[idx] = computeScoreAndSupport(&data, parents, node, scoreFun, support[idx]);
+						scoringSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+						++st.scored;
+						if (score[idx] > bestBelow[idx])
+							candidates.add(node, ss, score[idx]);
+						else
+							++st.dominated;
+					}
+				}
+				// next subset of the same size in colex order (Gosper's hack)
+				if (ss == 0)
+					break;
+				uint64_t c = ss & -ss;
+				uint64_t t = ss + c;
+				ss = t | (((t ^ ss) >> 2) / c);
+			}
+		}
+	}
+	candidates.sort();
+	st.candidates = candidates.size();
+	st.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	st.savedSeconds = st.scored ? scoringSeconds / st.scored * st.bounded : 0;
+	if (stats)
+		*stats = st;
+}
+
+void printPruningStats(std::ostream &out, const PruningStats &st)
+{
+	out << "parent sets: " << st.candidates << " candidates of " << st.total << ", " << st.bounded
+		<< " eliminated by bounds without scoring, " << st.dominated << " dominated by a subset" << std::endl;
+	out << "pruning time: " << st.seconds << " s, estimated scoring time saved: " << st.savedSeconds << " s" << std::endl;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include <vector>
+#include <stdint.h>
+
+#include "common.hpp"
+#include "data.hpp"
+#include "stacksubset.hpp"
+#include "scores.hpp"
+#include "metrics.hpp"
+
+#ifndef SAMPLECODES_HPP
+#define SAMPLECODES_HPP
+
+/**
+ * Counts through the mixed-radix codes of the samples under a prefix of
+ * variables. The codes of the variables of the last request are kept level
+ * by level, codes_[d][j] being the code of sample j under its first d
+ * variables; the next request keeps the levels of the common prefix and
+ * extends them one variable at a time with code * arity + value. Parent
+ * sets enumerated in lexicographic order share all but their last
+ * elements, so a table costs about two passes over the samples instead of
+ * one per variable. The tables are those of DataView::getCounts. Not
+ * thread-safe; every thread needs its own instance.
+ */
+class SampleCodes
+{
+private:
+	const DataView &data_;
+	int nSamples_;
+	bool supported_;
+	std::vector<std::vector<Datum> > columns_; // values per variable, extracted on first use
+	std::vector<int> prefix_;				   // variables of the current levels
+	std::vector<std::vector<int> > codes_;	 // codes_[d] for d = 1..prefix_.size()
+	uint64_t nExtended_;
+	uint64_t nReused_;
+
+	SampleCodes(const SampleCodes &);			 // disable copying
+	SampleCodes &operator=(const SampleCodes &); // disable copying
+
+	const std::vector<Datum> &column(int v)
+	{
+		if (columns_[v].empty() && nSamples_ > 0)
+			data_.getColumn(v, columns_[v]);
+		return columns_[v];
+	}
+
+	// appends variable v to the prefix
+	void extend(int v)
+	{
+		size_t d = prefix_.size();
+		if (codes_.size() <= d + 1)
+			codes_.resize(d + 2);
+		std::vector<int> &next = codes_[d + 1];
+		next.resize(nSamples_);
+		const Datum *values = nSamples_ ? &column(v)[0] : NULL;
+		if (d == 0)
+			for (int j = 0; j < nSamples_; ++j)
+				next[j] = values[j];
+		else
+		{
+			const int *codes = &codes_[d][0];
+			int arity = data_.getArity(v);
+			for (int j = 0; j < nSamples_; ++j)
+				next[j] = codes[j] * arity + values[j];
+		}
+		prefix_.push_back(v);
+		++nExtended_;
+	}
+
+public:
+	SampleCodes(const DataView &data)
+		: data_(data), nSamples_(data.getNumSamples()), columns_(data.getNumVariables()), nExtended_(0), nReused_(0)
+	{
+		std::vector<Datum> probe;
+		supported_ = data.getNumVariables() == 0 || data.getColumn(0, probe);
+	}
+
+	// false if the data view cannot list its values, in which case getCounts must not be used
+	bool isSupported() const
+	{
+		return supported_;
+	}
+
+	// the count table of vars like DataView::getCounts; the last variable is not kept as a prefix
+	int *getCounts(const std::vector<int> &vars)
+	{
+		size_t k = vars.size() - 1;
+		size_t common = 0;
+		while (common < k && common < prefix_.size() && prefix_[common] == vars[common])
+			++common;
+		nReused_ += common;
+		prefix_.resize(common);
+		for (size_t d = common; d < k; ++d)
+			extend(vars[d]);
+
+		int nNodeValues = data_.getArity(vars[k]);
+		int nValues = nNodeValues;
+		for (size_t i = 0; i < k; ++i)
+			nValues *= data_.getArity(vars[i]);
+		int *counts = new int[nValues];
+		for (int i = 0; i < nValues; ++i)
+			counts[i] = 0;
+		if (nSamples_ == 0)
+			return counts;
+		const Datum *values = &column(vars[k])[0];
+		if (k == 0)
+			for (int j = 0; j < nSamples_; ++j)
+				++counts[values[j]];
+		else
+		{
+			const int *codes = &codes_[k][0];
+			for (int j = 0; j < nSamples_; ++j)
+				++counts[codes[j] * nNodeValues + values[j]];
+		}
+		return counts;
+	}
+
+	// number of variables added to a prefix, and of prefix variables reused from the previous request
+	uint64_t getNumExtended() const
+	{
+		return nExtended_;
+	}
+
+	uint64_t getNumReused() const
+	{
+		return nReused_;
+	}
+};
+
+// computeScore with the counts taken from the sample codes
+double computeScore(SampleCodes &sampleCodes, const DataView *dataView, const StackSubset &parents, int node,
+					const ScoreFun *scoreFun)
+{
+	std::vector<int> vars(parents.size() + 1);
+	for (size_t i = 0; i < parents.size(); ++i)
+		vars[i] = parents[i];
+	vars[parents.size()] = node;
+	metrics.countComputeScore();
+	int *counts;
+	{
+		PhaseTimer timer(PHASE_COUNTING);
+		counts = sampleCodes.getCounts(vars);
+	}
+	int nParentValues = 1;
+	for (size_t i = 0; i < parents.size(); ++i)
+		nParentValues *= dataView->getArity(parents[i]);
+	int nNodeValues = dataView->getArity(node);
+	double score;
+	{
+		PhaseTimer timer(PHASE_SCORING);
+		score = scoreFun->compute(nNodeValues, nParentValues, counts);
+	}
+	delete[] counts;
+	return score;
+}
+
+#endif
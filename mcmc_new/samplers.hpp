@@ -0,0 +1,484 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+
+#include "common.hpp"
+#include "lognum.hpp"
+#include "data.hpp"
+#include "stacksubset.hpp"
+#include "scores.hpp"
+#include "scorecache.hpp"
+#include "order.hpp"
+#include "timer.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#ifndef SAMPLERS_HPP
+#define SAMPLERS_HPP
+
+// log local score of node with the parents in mask
+double maskScore(LocalScoreCache &localScores, uint64_t mask, int node)
+{
+	StackSubset parents(localScores.getNumVariables());
+	for (; mask; mask &= mask - 1)
+		parents.push(__builtin_ctzll(mask));
+	return localScores(parents, node);
+}
+
+// appends mask joined with every subset of items[start..] that has at most maxSize elements
+void enumerateParentSets(const vector<int> &items, size_t start, uint64_t mask, int maxSize, vector<uint64_t> &out)
+{
+	out.push_back(mask);
+	if (maxSize == 0)
+		return;
+	for (size_t i = start; i < items.size(); ++i)
+		enumerateParentSets(items, i + 1, mask | ((uint64_t)1 << items[i]), maxSize - 1, out);
+}
+
+// ancestors[v] = all nodes with a directed path to v
+void computeAncestors(const vector<uint64_t> &parents, vector<uint64_t> &ancestors)
+{
+	int n = parents.size();
+	uint64_t done = 0;
+	while (__builtin_popcountll(done) < n)
+	{
+		for (int v = 0; v < n; ++v)
+		{
+			if ((done & ((uint64_t)1 << v)) || (parents[v] & ~done))
+				continue;
+			ancestors[v] = parents[v];
+			for (uint64_t pa = parents[v]; pa; pa &= pa - 1)
+				ancestors[v] |= ancestors[__builtin_ctzll(pa)];
+			done |= (uint64_t)1 << v;
+		}
+	}
+}
+
+// adds the edges of the DAG given by the parent masks to the edge counts
+void countEdges(const vector<uint64_t> &parents, SquareMat<int> &res)
+{
+	for (size_t v = 0; v < parents.size(); ++v)
+		for (uint64_t pa = parents[v]; pa; pa &= pa - 1)
+			res(__builtin_ctzll(pa), v)++;
+}
+
+// writes the summary and result.dat of a sampler run, like the end of myMCMC
+void finishSampler(LocalScoreCache &localScores, const MCMCOptions &options, const SquareMat<int> &res, int sample_count,
+				   uint64_t nProposed, uint64_t nAccepted, double elapsed)
+{
+	metrics.setCacheStats(localScores.getNumHits(), localScores.getNumComputed());
+	if (!options.metricsFile.empty())
+	{
+		ofstream metricsOut(options.metricsFile.c_str(), ios::out | ios::trunc);
+		metricsOut << metrics.toJson() << endl;
+	}
+	cout << "moves: " << nAccepted << " of " << nProposed << " accepted" << endl;
+	cout << "sample count: " << sample_count << endl;
+	cout << "time elapsed: " << elapsed << endl;
+	writeEdgeFrequencies("result.dat", res, sample_count);
+	if (!localScores.save())
+		cout << "could not write score store " << localScores.getStore()->getPath() << endl;
+}
+
+/**
+ * Structure MCMC over DAGs with at most maxParentSize parents per node
+ * under a uniform prior. A move picks a random pair of nodes: without an
+ * edge between them one direction is added, with an edge it is removed or
+ * reversed, each with probability 1/2. The proposal is symmetric, so the
+ * acceptance ratio is the score ratio; proposals that would create a cycle
+ * or exceed the in-degree are rejected. Ancestor sets are kept as bit
+ * masks, which makes the acyclicity check of a move O(in-degree), and only
+ * the one or two nodes whose parents change are rescored.
+ */
+void structureMCMC(Data &data, vector<int> &targets, const MCMCOptions &options)
+{
+	enum EdgeMove
+	{
+		EDGE_ADD,
+		EDGE_REMOVE,
+		EDGE_REVERSE
+	};
+
+	Timer timer;
+	metrics.reset();
+	double equivalentSampleSize = 1;
+	int n = targets.size();
+	int maxParentSize = options.maxParentSize;
+	if (n > 64)
+		throw Exception("Structure MCMC supports at most 64 variables");
+	BDeuScore scoreFun(equivalentSampleSize);
+	std::mt19937 gen(options.seed);
+	if (options.seed == 0)
+	{
+		random_device rd;
+		gen.seed(rd());
+	}
+	DataColumns datacolumns(data, targets);
+	LocalScoreCache localScores(datacolumns, &scoreFun, maxParentSize);
+	if (!options.scoreStore.empty())
+		attachScoreStore(localScores, data, targets, options.scoreStore, equivalentSampleSize);
+	std::uniform_real_distribution<double> dis(0.0, 1.0);
+	std::uniform_int_distribution<> nodeDis(0, n - 1);
+
+	// start from the empty graph
+	vector<uint64_t> parents(n, 0), ancestors(n, 0);
+	vector<double> nodeScores(n);
+	double score = 0;
+	for (int v = 0; v < n; ++v)
+		score += nodeScores[v] = maskScore(localScores, 0, v);
+
+	SquareMat<int> res(n);
+	res.setAll(0);
+	int sample_count = 0;
+	uint64_t nProposed = 0, nAccepted = 0;
+	int temp = options.burnIn;
+	timer.start();
+	while (temp--)
+	{
+		TraceSpan span("mcmc_iteration");
+		bool proposed = false, accepted = false;
+		if (n >= 2)
+		{
+			int u = nodeDis(gen), w;
+			do
+				w = nodeDis(gen);
+			while (w == u);
+			if (parents[u] & ((uint64_t)1 << w))
+				std::swap(u, w); // so that an existing edge is u -> w
+			bool coin = dis(gen) < 0.5;
+			EdgeMove move;
+			if (!(parents[w] & ((uint64_t)1 << u)))
+			{
+				move = EDGE_ADD;
+				if (coin)
+					std::swap(u, w);
+			}
+			else
+				move = coin ? EDGE_REMOVE : EDGE_REVERSE;
+			uint64_t ub = (uint64_t)1 << u, wb = (uint64_t)1 << w;
+
+			// new parents of w and, for a reversal, of u
+			uint64_t newW = parents[w], newU = parents[u];
+			bool legal;
+			if (move == EDGE_ADD)
+			{
+				newW |= ub;
+				legal = __builtin_popcountll(parents[w]) < maxParentSize && !(ancestors[u] & wb);
+			}
+			else if (move == EDGE_REMOVE)
+			{
+				newW &= ~ub;
+				legal = true;
+			}
+			else
+			{
+				newW &= ~ub;
+				newU |= wb;
+				// the reversal closes a cycle if another path leads from u to w
+				legal = __builtin_popcountll(parents[u]) < maxParentSize;
+				for (uint64_t pa = newW; pa && legal; pa &= pa - 1)
+					legal = !(ancestors[__builtin_ctzll(pa)] & ub);
+			}
+			if (legal)
+			{
+				proposed = true;
+				++nProposed;
+				double scoreW = maskScore(localScores, newW, w);
+				double scoreU = move == EDGE_REVERSE ? maskScore(localScores, newU, u) : nodeScores[u];
+				double delta = scoreW - nodeScores[w] + scoreU - nodeScores[u];
+				if (log(dis(gen)) < delta)
+				{
+					accepted = true;
+					++nAccepted;
+					parents[w] = newW;
+					parents[u] = newU;
+					nodeScores[w] = scoreW;
+					nodeScores[u] = scoreU;
+					score += delta;
+					if (move == EDGE_ADD)
+					{
+						// an added edge only extends the ancestors of w and its descendants
+						uint64_t extra = ancestors[u] | ub;
+						for (int x = 0; x < n; ++x)
+							if (x == w || (ancestors[x] & wb))
+								ancestors[x] |= extra;
+					}
+					else
+						computeAncestors(parents, ancestors);
+				}
+			}
+		}
+		metrics.countIteration(proposed, accepted);
+		metrics.setCurrentScore(score);
+		if (temp % 10 == 0)
+		{
+			sample_count++;
+			countEdges(parents, res);
+		}
+	}
+	finishSampler(localScores, options, res, sample_count, nProposed, nAccepted, timer.elapsed());
+}
+
+/**
+ * Ordered partition of the nodes for partition MCMC. The parents of a node
+ * come from the earlier blocks and include at least one node of the block
+ * right before its own, so every DAG belongs to exactly one partition.
+ */
+struct NodePartition
+{
+	vector<uint64_t> blocks;
+
+	// nodes of the earlier blocks (allowed) and of the block before (required) for every node
+	void getParentMasks(int n, vector<uint64_t> &allowed, vector<uint64_t> &required) const
+	{
+		allowed.resize(n);
+		required.resize(n);
+		uint64_t before = 0, prev = 0;
+		for (size_t b = 0; b < blocks.size(); ++b)
+		{
+			for (uint64_t m = blocks[b]; m; m &= m - 1)
+			{
+				int v = __builtin_ctzll(m);
+				allowed[v] = before;
+				required[v] = prev;
+			}
+			before |= blocks[b];
+			prev = blocks[b];
+		}
+	}
+
+	// number of partitions reachable by joining two neighbouring blocks or splitting one block in two
+	double getNumSplitJoins() const
+	{
+		double total = blocks.size() - 1;
+		for (size_t b = 0; b < blocks.size(); ++b)
+			total += ldexp(1.0, __builtin_popcountll(blocks[b])) - 2;
+		return total;
+	}
+};
+
+// parent sets of node that are consistent with its position in a partition, at most maxParents of them
+void partitionParentSets(uint64_t allowed, uint64_t required, int maxParents, vector<uint64_t> &out)
+{
+	out.clear();
+	if (required == 0)
+	{
+		out.push_back(0);
+		return;
+	}
+	vector<int> items;
+	for (uint64_t m = allowed; m; m &= m - 1)
+		items.push_back(__builtin_ctzll(m));
+	vector<uint64_t> all;
+	enumerateParentSets(items, 0, 0, maxParents, all);
+	for (size_t k = 0; k < all.size(); ++k)
+		if (all[k] & required)
+			out.push_back(all[k]);
+}
+
+// log of the summed score of the parent sets of node consistent with its position in a partition
+double partitionNodeScore(LocalScoreCache &localScores, int node, uint64_t allowed, uint64_t required, int maxParents,
+						  vector<uint64_t> &sets, vector<double> &scores)
+{
+	partitionParentSets(allowed, required, maxParents, sets);
+	scores.resize(sets.size());
+	double best = -std::numeric_limits<double>::infinity();
+	for (size_t k = 0; k < sets.size(); ++k)
+		best = std::max(best, scores[k] = maskScore(localScores, sets[k], node));
+	if (best == -std::numeric_limits<double>::infinity())
+		return best;
+	double sum = 0;
+	for (size_t k = 0; k < sets.size(); ++k)
+		sum += exp(scores[k] - best);
+	return best + log(sum);
+}
+
+// index in sets of a parent set drawn with probability proportional to its score, for log(uniform) + log(total) = u
+template <class LogAdd>
+size_t drawParentSet(LocalScoreCache &localScores, const vector<uint64_t> &sets, int node, double u)
+{
+	Lognum<double, LogAdd> cum;
+	size_t k = 0;
+	for (; k + 1 < sets.size(); ++k)
+	{
+		Lognum<double, LogAdd> s;
+		s.setLog(maskScore(localScores, sets[k], node));
+		cum += s;
+		if (cum.getLog() > u)
+			break;
+	}
+	return k;
+}
+
+/**
+ * Partition MCMC (Kuipers and Moffa 2017) under a uniform prior over DAGs
+ * with at most maxParentSize parents per node. Moves either split a block
+ * in two or join two neighbouring blocks, chosen uniformly among all such
+ * partitions with the Hastings ratio of the neighbourhood sizes, or swap
+ * two nodes of different blocks. Only nodes whose allowed or required
+ * parents change are rescored. Each sample draws a DAG from the current
+ * partition with parent sets in proportion to their scores.
+ */
+void partitionMCMC(Data &data, vector<int> &targets, const MCMCOptions &options)
+{
+	Timer timer;
+	metrics.reset();
+	double equivalentSampleSize = 1;
+	int n = targets.size();
+	int maxParentSize = options.maxParentSize;
+	if (n > 64)
+		throw Exception("Partition MCMC supports at most 64 variables");
+	BDeuScore scoreFun(equivalentSampleSize);
+	std::mt19937 gen(options.seed);
+	if (options.seed == 0)
+	{
+		random_device rd;
+		gen.seed(rd());
+	}
+	DataColumns datacolumns(data, targets);
+	LocalScoreCache localScores(datacolumns, &scoreFun, maxParentSize);
+	if (!options.scoreStore.empty())
+		attachScoreStore(localScores, data, targets, options.scoreStore, equivalentSampleSize);
+	std::uniform_real_distribution<double> dis(0.0, 1.0);
+	std::uniform_int_distribution<> nodeDis(0, n - 1);
+	vector<uint64_t> sets;
+	vector<double> setScores;
+
+	// start from a single block, i.e. the empty graph
+	NodePartition partition;
+	partition.blocks.push_back(n == 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1);
+	vector<uint64_t> allowed, required;
+	partition.getParentMasks(n, allowed, required);
+	vector<double> nodeScores(n);
+	double score = 0;
+	for (int v = 0; v < n; ++v)
+		score += nodeScores[v] = partitionNodeScore(localScores, v, allowed[v], required[v], maxParentSize, sets, setScores);
+
+	NodePartition proposal;
+	vector<uint64_t> newAllowed, newRequired;
+	vector<double> newScores(n);
+	vector<uint64_t> dag(n);
+	SquareMat<int> res(n);
+	res.setAll(0);
+	int sample_count = 0;
+	uint64_t nProposed = 0, nAccepted = 0;
+	int temp = options.burnIn;
+	timer.start();
+	while (temp--)
+	{
+		TraceSpan span("mcmc_iteration");
+		bool proposed = false, accepted = false;
+		proposal = partition;
+		double logHastings = 0;
+		int m = partition.blocks.size();
+		if (dis(gen) < 0.5)
+		{
+			double nMoves = partition.getNumSplitJoins();
+			if (nMoves > 0)
+			{
+				proposed = true;
+				double r = dis(gen) * nMoves;
+				if (r < m - 1)
+				{
+					int b = (int)r;
+					proposal.blocks[b] |= proposal.blocks[b + 1];
+					proposal.blocks.erase(proposal.blocks.begin() + b + 1);
+				}
+				else
+				{
+					// block b with probability proportional to its number of splits
+					r -= m - 1;
+					int b = -1;
+					for (int c = 0; c < m; ++c)
+					{
+						double nSplits = ldexp(1.0, __builtin_popcountll(partition.blocks[c])) - 2;
+						if (nSplits > 0)
+						{
+							b = c;
+							if (r < nSplits)
+								break;
+							r -= nSplits;
+						}
+					}
+					// the nodes of block b picked by a random proper non-empty subset go first
+					int k = __builtin_popcountll(partition.blocks[b]);
+					std::uniform_int_distribution<uint64_t> subsetDis(1, (k == 64 ? ~(uint64_t)0 : ((uint64_t)1 << k) - 1) - 1);
+					uint64_t pick = subsetDis(gen), first = 0;
+					int j = 0;
+					for (uint64_t rest = partition.blocks[b]; rest; rest &= rest - 1, ++j)
+						if (pick & ((uint64_t)1 << j))
+							first |= rest & -rest;
+					proposal.blocks[b] = first;
+					proposal.blocks.insert(proposal.blocks.begin() + b + 1, partition.blocks[b] & ~first);
+				}
+				logHastings = log(nMoves) - log(proposal.getNumSplitJoins());
+			}
+		}
+		else if (m > 1)
+		{
+			// a uniform pair of nodes in different blocks; the number of such pairs does not change
+			int u = nodeDis(gen), w;
+			int bu = 0;
+			while (!(partition.blocks[bu] & ((uint64_t)1 << u)))
+				++bu;
+			do
+				w = nodeDis(gen);
+			while (partition.blocks[bu] & ((uint64_t)1 << w));
+			int bw = 0;
+			while (!(partition.blocks[bw] & ((uint64_t)1 << w)))
+				++bw;
+			uint64_t swapBits = ((uint64_t)1 << u) | ((uint64_t)1 << w);
+			proposal.blocks[bu] ^= swapBits;
+			proposal.blocks[bw] ^= swapBits;
+			proposed = true;
+		}
+		if (proposed)
+		{
+			++nProposed;
+			proposal.getParentMasks(n, newAllowed, newRequired);
+			double delta = logHastings;
+			for (int v = 0; v < n; ++v)
+			{
+				if (newAllowed[v] == allowed[v] && newRequired[v] == required[v])
+					newScores[v] = nodeScores[v];
+				else
+				{
+					newScores[v] = partitionNodeScore(localScores, v, newAllowed[v], newRequired[v], maxParentSize, sets, setScores);
+					delta += newScores[v] - nodeScores[v];
+				}
+			}
+			if (log(dis(gen)) < delta)
+			{
+				accepted = true;
+				++nAccepted;
+				partition.blocks.swap(proposal.blocks);
+				allowed.swap(newAllowed);
+				required.swap(newRequired);
+				nodeScores.swap(newScores);
+				score += delta - logHastings;
+			}
+		}
+		metrics.countIteration(proposed, accepted);
+		metrics.setCurrentScore(score);
+		if (temp % 10 == 0)
+		{
+			sample_count++;
+			for (int v = 0; v < n; ++v)
+			{
+				partitionParentSets(allowed[v], required[v], maxParentSize, sets);
+				double u = log(dis(gen)) + nodeScores[v];
+				size_t k = options.fastLogAdd ? drawParentSet<FastLogAdd>(localScores, sets, v, u)
+											  : drawParentSet<ExactLogAdd>(localScores, sets, v, u);
+				dag[v] = sets.empty() ? 0 : sets[k];
+			}
+			countEdges(dag, res);
+		}
+	}
+	finishSampler(localScores, options, res, sample_count, nProposed, nAccepted, timer.elapsed());
+}
+
+#endif
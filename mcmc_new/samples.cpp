@@ -0,0 +1,85 @@
+// Reads a sample file written by main --samples.
+//
+// With --edges the edge frequencies over all samples are written in the
+// format of result.dat; with --text every sample is printed as one line
+// "score <log score> order <nodes> edges <i>-><j> ...".
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include "common.hpp"
+#include "bitmatrix.hpp"
+#include "samplesink.hpp"
+#include "order.hpp"
+#include <boost/program_options.hpp>
+using namespace std;
+namespace opts = boost::program_options;
+
+int main(int argc, char **argv)
+{
+	string inputFile;
+	string edgesFile;
+	opts::options_description desc("Options");
+	opts::variables_map vm;
+	desc.add_options()
+	("input-file,i", opts::value<string>(&inputFile), "sample file to read")
+	("edges,e", opts::value<string>(&edgesFile), "write the edge frequencies to this file")
+	("text,t", "print every sample as a line of text")
+	("help,h", "produce help message");
+	opts::positional_options_description pdesc;
+	pdesc.add("input-file", 1);
+	try
+	{
+		opts::store(opts::command_line_parser(argc, argv).options(desc).positional(pdesc).run(), vm);
+		opts::notify(vm);
+	}
+	catch (opts::error &err)
+	{
+		cerr << "Error:" << err.what() << endl;
+		return 1;
+	}
+	if (vm.count("help") || inputFile.empty())
+	{
+		cerr << desc << endl;
+		return 1;
+	}
+	bool text = vm.count("text") > 0;
+	try
+	{
+		SampleReader reader(inputFile);
+		int n = reader.getNumVariables();
+		BitMatrix dag(n);
+		SquareMat<int> res(n);
+		res.setAll(0);
+		vector<int> order;
+		double logScore;
+		int sample_count = 0;
+		while (reader.next(order, dag, logScore))
+		{
+			++sample_count;
+			dag.addTo(res);
+			if (!text)
+				continue;
+			cout << "score " << setprecision(10) << logScore << " order";
+			for (int i = 0; i < n; ++i)
+				cout << " " << order[i];
+			cout << " edges";
+			for (int j = 0; j < n; ++j)
+				for (int i = 0; i < n; ++i)
+					if (dag(i, j))
+						cout << " " << i << "->" << j;
+			cout << endl;
+		}
+		if (!edgesFile.empty())
+			writeEdgeFrequencies(edgesFile.c_str(), res, sample_count);
+		cerr << sample_count << " samples of " << n << " variables" << endl;
+	}
+	catch (Exception &err)
+	{
+		cerr << "Error: " << err.what() << endl;
+		return 1;
+	}
+	return 0;
+}
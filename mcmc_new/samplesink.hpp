@@ -0,0 +1,389 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <stdint.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "common.hpp"
+#include "bitmatrix.hpp"
+
+#ifndef SAMPLESINK_HPP
+#define SAMPLESINK_HPP
+
+/*
+ * Sample files hold every retained sample of a run: a header
+ *   char magic[8] = "BNSAMP01", uint32 nVariables, uint32 recordSize
+ * followed by zlib-compressed blocks
+ *   uint32 nRecords, uint32 rawSize, uint32 compressedSize, bytes
+ * of fixed-size records
+ *   double logScore, int32 order[n], uint64 parents[n][(n + 63) / 64]
+ * where parents[j] are the words of row j of the sampled BitMatrix.
+ */
+static const char SAMPLE_FILE_MAGIC[8] = {'B', 'N', 'S', 'A', 'M', 'P', '0', '1'};
+
+size_t sampleRecordSize(int n)
+{
+	return sizeof(double) + n * sizeof(int32_t) + (size_t)n * ((n + 63) / 64) * sizeof(uint64_t);
+}
+
+/**
+ * Reads the samples of a sample file one at a time.
+ */
+class SampleReader
+{
+private:
+	FILE *file_;
+	std::string path_;
+	int n_;
+	size_t recordSize_;
+	std::vector<unsigned char> block_;
+	size_t nRecords_; // in block_
+	size_t next_;
+
+	SampleReader(const SampleReader &);			   // disable copying
+	SampleReader &operator=(const SampleReader &); // disable copying
+
+	bool readBlock()
+	{
+		uint32_t header[3];
+		if (fread(header, sizeof(header), 1, file_) != 1)
+			return false;
+		if (header[0] == 0 || header[2] == 0 || header[1] != (uint64_t)header[0] * recordSize_)
+			throw Exception("Corrupt block in %s") % path_;
+		std::vector<unsigned char> compressed(header[2]);
+		uLongf rawSize = header[1];
+		block_.resize(rawSize);
+		if (fread(&compressed[0], 1, compressed.size(), file_) != compressed.size() ||
+			uncompress(&block_[0], &rawSize, &compressed[0], compressed.size()) != Z_OK ||
+			rawSize != (uLongf)header[0] * recordSize_)
+			throw Exception("Corrupt block in %s") % path_;
+		nRecords_ = header[0];
+		next_ = 0;
+		return true;
+	}
+
+public:
+	SampleReader(const std::string &path) : path_(path), nRecords_(0), next_(0)
+	{
+		file_ = fopen(path.c_str(), "rb");
+		if (file_ == NULL)
+			throw Exception("Could not open %s") % path;
+		char magic[8];
+		uint32_t sizes[2];
+		if (fread(magic, sizeof(magic), 1, file_) != 1 || memcmp(magic, SAMPLE_FILE_MAGIC, sizeof(magic)) != 0 ||
+			fread(sizes, sizeof(sizes), 1, file_) != 1 || sizes[1] != sampleRecordSize(sizes[0]))
+		{
+			fclose(file_);
+			throw Exception("%s is not a sample file") % path;
+		}
+		n_ = sizes[0];
+		recordSize_ = sizes[1];
+	}
+
+	~SampleReader()
+	{
+		fclose(file_);
+	}
+
+	int getNumVariables() const
+	{
+		return n_;
+	}
+
+	// the bytes of the next record, NULL at the end of the file
+	const unsigned char *nextRecord()
+	{
+		if (next_ == nRecords_ && !readBlock())
+			return NULL;
+		return &block_[next_++ * recordSize_];
+	}
+
+	// reads the next sample, false at the end of the file; dag must have getNumVariables() nodes
+	bool next(std::vector<int> &order, BitMatrix &dag, double &logScore)
+	{
+		const unsigned char *record = nextRecord();
+		if (record == NULL)
+			return false;
+		memcpy(&logScore, record, sizeof(double));
+		record += sizeof(double);
+		order.resize(n_);
+		for (int i = 0; i < n_; ++i)
+		{
+			int32_t v;
+			memcpy(&v, record, sizeof(v));
+			order[i] = v;
+			record += sizeof(v);
+		}
+		memcpy(dag.getParents(0), record, (size_t)n_ * dag.getNumWords() * sizeof(uint64_t));
+		return true;
+	}
+};
+
+/**
+ * Streams samples to a sample file. push() copies the sample into a slot of
+ * a bounded single-producer single-consumer ring and returns at once; a
+ * writer thread drains the ring, compresses blocks of records and writes
+ * them. The chain never waits for the disk: if the writer falls a whole
+ * ring behind, the sample is dropped and counted instead. The destructor
+ * writes everything still queued; sync() does so too, for a checkpoint,
+ * and waits for it.
+ *
+ * A resumed chain continues its sample file: the first nKept samples of
+ * the existing file are copied to a fresh one that then receives the new
+ * samples, so samples written after the checkpoint do not appear twice.
+ * A checkpoint records the count sync() returns, so only a file damaged
+ * after it can lack samples it counted; getNumLost() tells how many.
+ */
+class SampleSink
+{
+private:
+	FILE *file_;
+	std::string path_;
+	int n_;
+	size_t recordSize_;
+	size_t capacity_; // slots of the ring
+	int blockRecords_;
+	std::vector<unsigned char> slots_;
+	std::atomic<uint64_t> head_; // next slot to write out, advanced by the writer
+	std::atomic<uint64_t> tail_; // next slot to fill, advanced by push
+	std::atomic<bool> stop_;
+	std::atomic<bool> syncRequest_; // set by sync, cleared by the writer once the ring is on disk
+	std::atomic<uint64_t> nSynced_; // records of this sink flushed to the file without error
+	uint64_t nDropped_;
+	uint64_t nWritten_; // read after the writer has stopped
+	uint64_t nKept_;	// samples taken over from the file of an earlier run
+	uint64_t nLost_;
+	bool ok_;
+	std::thread thread_;
+
+	SampleSink(const SampleSink &);			   // disable copying
+	SampleSink &operator=(const SampleSink &); // disable copying
+
+	bool writeBlock(const std::vector<unsigned char> &raw, int nRecords)
+	{
+		uLongf compressedSize = compressBound(raw.size());
+		std::vector<unsigned char> compressed(compressedSize);
+		if (compress2(&compressed[0], &compressedSize, &raw[0], raw.size(), 1) != Z_OK)
+			return false;
+		uint32_t header[3] = {(uint32_t)nRecords, (uint32_t)raw.size(), (uint32_t)compressedSize};
+		// flushed block by block, so an interrupted run leaves whole blocks for a resume
+		return fwrite(header, sizeof(header), 1, file_) == 1 &&
+			   fwrite(&compressed[0], 1, compressedSize, file_) == compressedSize && fflush(file_) == 0;
+	}
+
+	void run()
+	{
+		std::vector<unsigned char> block;
+		block.reserve(blockRecords_ * recordSize_);
+		int nRecords = 0;
+		while (true)
+		{
+			uint64_t head = head_.load(std::memory_order_relaxed);
+			if (head == tail_.load(std::memory_order_acquire))
+			{
+				// sync() is called from the chain's thread between pushes, so everything pushed is in block
+				if (syncRequest_.load(std::memory_order_acquire))
+				{
+					if (nRecords > 0)
+					{
+						ok_ = writeBlock(block, nRecords) && ok_;
+						nWritten_ += nRecords;
+						block.clear();
+						nRecords = 0;
+					}
+					if (ok_)
+						nSynced_.store(nWritten_, std::memory_order_relaxed);
+					syncRequest_.store(false, std::memory_order_release);
+				}
+				// stop_ is set after the last push, so a ring still empty after seeing it is drained
+				if (stop_.load(std::memory_order_acquire) && head == tail_.load(std::memory_order_acquire))
+					break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			const unsigned char *slot = &slots_[(head % capacity_) * recordSize_];
+			block.insert(block.end(), slot, slot + recordSize_);
+			head_.store(head + 1, std::memory_order_release);
+			if (++nRecords == blockRecords_)
+			{
+				ok_ = writeBlock(block, nRecords) && ok_;
+				nWritten_ += nRecords;
+				if (ok_)
+					nSynced_.store(nWritten_, std::memory_order_relaxed);
+				block.clear();
+				nRecords = 0;
+			}
+		}
+		if (nRecords > 0)
+		{
+			ok_ = writeBlock(block, nRecords) && ok_;
+			nWritten_ += nRecords;
+		}
+		ok_ = (fclose(file_) == 0) && ok_;
+	}
+
+	// copies up to nKept records of the sample file at path_ to file_, up to a truncated last block
+	void keepRecords(uint64_t nKept)
+	{
+		SampleReader reader(path_);
+		if (reader.getNumVariables() != n_)
+			throw Exception("%s holds samples of %d variables, not %d") % path_ % reader.getNumVariables() % n_;
+		std::vector<unsigned char> block;
+		int nRecords = 0;
+		try
+		{
+			const unsigned char *record;
+			while (nKept_ < nKept && (record = reader.nextRecord()) != NULL)
+			{
+				block.insert(block.end(), record, record + recordSize_);
+				++nKept_;
+				if (++nRecords == blockRecords_)
+				{
+					ok_ = writeBlock(block, nRecords) && ok_;
+					block.clear();
+					nRecords = 0;
+				}
+			}
+		}
+		catch (Exception &)
+		{
+			// the block an interrupted run was writing
+		}
+		if (nRecords > 0)
+			ok_ = writeBlock(block, nRecords) && ok_;
+		nLost_ = nKept - nKept_;
+	}
+
+public:
+	/**
+	 * Starts the sample file at path, or continues it with its first nKept
+	 * samples when nKept is positive.
+	 */
+	SampleSink(const std::string &path, int nVariables, uint64_t nKept = 0, size_t capacity = 4096, int blockRecords = 256)
+		: path_(path), n_(nVariables), recordSize_(sampleRecordSize(nVariables)), capacity_(capacity),
+		  blockRecords_(blockRecords), slots_(capacity * sampleRecordSize(nVariables)), head_(0), tail_(0),
+		  stop_(false), syncRequest_(false), nSynced_(0), nDropped_(0), nWritten_(0), nKept_(0), nLost_(0), ok_(true)
+	{
+		// the kept samples are read from the old file while the new one is written
+		std::string openPath = nKept > 0 ? path + ".tmp" : path;
+		file_ = fopen(openPath.c_str(), "wb");
+		if (file_ == NULL)
+			throw Exception("Could not open %s") % openPath;
+		uint32_t sizes[2] = {(uint32_t)n_, (uint32_t)recordSize_};
+		if (fwrite(SAMPLE_FILE_MAGIC, sizeof(SAMPLE_FILE_MAGIC), 1, file_) != 1 || fwrite(sizes, sizeof(sizes), 1, file_) != 1 ||
+			fflush(file_) != 0)
+		{
+			fclose(file_);
+			throw Exception("Could not write %s") % openPath;
+		}
+		if (nKept > 0)
+		{
+			try
+			{
+				keepRecords(nKept);
+			}
+			catch (Exception &)
+			{
+				fclose(file_);
+				unlink(openPath.c_str());
+				throw;
+			}
+			if (!ok_ || rename(openPath.c_str(), path.c_str()) != 0)
+			{
+				fclose(file_);
+				unlink(openPath.c_str());
+				throw Exception("Could not write %s") % path;
+			}
+		}
+		thread_ = std::thread(&SampleSink::run, this);
+	}
+
+	~SampleSink()
+	{
+		close();
+	}
+
+	// writes out the queued samples and closes the file; returns false if a write failed
+	bool close()
+	{
+		if (thread_.joinable())
+		{
+			stop_.store(true, std::memory_order_release);
+			thread_.join();
+		}
+		return ok_;
+	}
+
+	// queues a sample from the chain's thread; false if it had to be dropped
+	bool push(const std::vector<int> &order, const BitMatrix &dag, double logScore)
+	{
+		uint64_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail - head_.load(std::memory_order_acquire) == capacity_)
+		{
+			++nDropped_;
+			return false;
+		}
+		unsigned char *slot = &slots_[(tail % capacity_) * recordSize_];
+		memcpy(slot, &logScore, sizeof(double));
+		slot += sizeof(double);
+		for (int i = 0; i < n_; ++i)
+		{
+			int32_t v = order[i];
+			memcpy(slot, &v, sizeof(v));
+			slot += sizeof(v);
+		}
+		memcpy(slot, dag.getParents(0), (size_t)n_ * dag.getNumWords() * sizeof(uint64_t));
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	const std::string &getPath() const
+	{
+		return path_;
+	}
+
+	uint64_t getNumDropped() const
+	{
+		return nDropped_;
+	}
+
+	/**
+	 * Writes the samples pushed so far, including a partial block, and
+	 * returns the number of samples the file holds, which is what a
+	 * checkpoint records. Call it from the thread that pushes.
+	 */
+	uint64_t sync()
+	{
+		if (!thread_.joinable())
+			return nKept_ + nWritten_;
+		syncRequest_.store(true, std::memory_order_release);
+		while (syncRequest_.load(std::memory_order_acquire))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		return nKept_ + nSynced_.load(std::memory_order_relaxed);
+	}
+
+	// samples taken over from an earlier run
+	uint64_t getNumKept() const
+	{
+		return nKept_;
+	}
+
+	// samples of an earlier run that its file was missing
+	uint64_t getNumLost() const
+	{
+		return nLost_;
+	}
+
+	// samples written by this sink, valid after close()
+	uint64_t getNumWritten() const
+	{
+		return nWritten_;
+	}
+};
+
+#endif
@@ -0,0 +1,253 @@
+// Accuracy-vs-time scoreboard.
+//
+// For every network size, generates a network and data with gennet, runs the
+// learner on it in a work directory and compares the learner's result.dat
+// with the true graph. Prints one tab separated row per run with wall time,
+// peak resident memory, structural Hamming distance and edge AUROC.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "common.hpp"
+#include <boost/program_options.hpp>
+using namespace std;
+namespace opts = boost::program_options;
+
+// reads an n x n edge matrix in result.dat format
+vector<double> readEdges(const string &path, int n)
+{
+	ifstream in(path.c_str());
+	if (!in.is_open())
+		throw Exception("Could not open %s") % path;
+	vector<double> edges(n * n, 0.0);
+	int i, j;
+	string arrow;
+	double p;
+	while (in >> i >> arrow >> j >> p)
+	{
+		if (i < 0 || i >= n || j < 0 || j >= n)
+			throw Exception("Edge %d --> %d out of range in %s") % i % j % path;
+		edges[i * n + j] = p;
+	}
+	return edges;
+}
+
+/**
+ * Structural Hamming distance between the true DAG and the graph obtained by
+ * keeping the edges with posterior above threshold (the more probable
+ * direction if both are). A missing, extra or reversed edge counts as one.
+ */
+int structuralHammingDistance(const vector<double> &truth, const vector<double> &posterior, int n, double threshold)
+{
+	int shd = 0;
+	for (int i = 0; i < n; ++i)
+	{
+		for (int j = i + 1; j < n; ++j)
+		{
+			int t = truth[i * n + j] > 0.5 ? 1 : (truth[j * n + i] > 0.5 ? -1 : 0);
+			double pij = posterior[i * n + j], pji = posterior[j * n + i];
+			int e = 0;
+			if (pij > threshold || pji > threshold)
+				e = pij >= pji ? 1 : -1;
+			if (t != e)
+				++shd;
+		}
+	}
+	return shd;
+}
+
+// area under the ROC curve of the directed edge posteriors, ties count half
+double edgeAUROC(const vector<double> &truth, const vector<double> &posterior, int n)
+{
+	vector<pair<double, int> > scored;
+	for (int i = 0; i < n; ++i)
+		for (int j = 0; j < n; ++j)
+			if (i != j)
+				scored.push_back(make_pair(posterior[i * n + j], truth[i * n + j] > 0.5 ? 1 : 0));
+	sort(scored.begin(), scored.end());
+	double rankSum = 0;
+	size_t nPos = 0;
+	for (size_t a = 0; a < scored.size();)
+	{
+		size_t b = a;
+		while (b < scored.size() && scored[b].first == scored[a].first)
+			++b;
+		double rank = (a + 1 + b) / 2.0; // average of ranks a+1 .. b
+		for (size_t c = a; c < b; ++c)
+			if (scored[c].second)
+			{
+				rankSum += rank;
+				++nPos;
+			}
+		a = b;
+	}
+	size_t nNeg = scored.size() - nPos;
+	if (nPos == 0 || nNeg == 0)
+		return 0.5;
+	return (rankSum - nPos * (nPos + 1) / 2.0) / ((double)nPos * nNeg);
+}
+
+struct RunResult
+{
+	int status;
+	double wallTime;
+	long peakRssKb;
+};
+
+// runs a command in dir with its output sent to logFile
+RunResult runCommand(const vector<string> &args, const string &dir, const string &logFile)
+{
+	RunResult res;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	pid_t pid = fork();
+	if (pid < 0)
+		throw Exception("fork failed: %s") % strerror(errno);
+	if (pid == 0)
+	{
+		if (chdir(dir.c_str()) != 0)
+			_exit(127);
+		int fd = open(logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd >= 0)
+		{
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+		vector<char *> argv;
+		for (size_t i = 0; i < args.size(); ++i)
+			argv.push_back(const_cast<char *>(args[i].c_str()));
+		argv.push_back(NULL);
+		execv(argv[0], &argv[0]);
+		_exit(127);
+	}
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) < 0)
+		throw Exception("wait4 failed: %s") % strerror(errno);
+	res.wallTime = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	res.peakRssKb = usage.ru_maxrss;
+	res.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	return res;
+}
+
+vector<string> splitArgs(const string &s)
+{
+	vector<string> args;
+	istringstream in(s);
+	string arg;
+	while (in >> arg)
+		args.push_back(arg);
+	return args;
+}
+
+string absolutePath(const string &path)
+{
+	if (!path.empty() && path[0] == '/')
+		return path;
+	char buf[4096];
+	if (getcwd(buf, sizeof(buf)) == NULL)
+		throw Exception("getcwd failed");
+	return string(buf) + "/" + path;
+}
+
+int main(int argc, char **argv)
+{
+	string sizesArg, learner, generator, learnerArgs, workDir;
+	int nSamples, maxIndegree, nRuns;
+	double threshold;
+
+	opts::options_description desc("Options");
+	opts::variables_map vm;
+	desc.add_options()
+	("sizes", opts::value<string>(&sizesArg)->default_value("8 12 16"), "network sizes to evaluate")
+	("samples,N", opts::value<int>(&nSamples)->default_value(1000), "number of samples per data set")
+	("max-indegree,k", opts::value<int>(&maxIndegree)->default_value(2), "maximum in-degree of the true networks")
+	("runs,r", opts::value<int>(&nRuns)->default_value(1), "number of networks per size")
+	("learner", opts::value<string>(&learner)->default_value("./main"), "learner executable")
+	("learner-args", opts::value<string>(&learnerArgs)->default_value("-b 1000"), "extra arguments passed to the learner")
+	("generator", opts::value<string>(&generator)->default_value("./gennet"), "network generator executable")
+	("threshold", opts::value<double>(&threshold)->default_value(0.5), "posterior threshold for the structural Hamming distance")
+	("work-dir", opts::value<string>(&workDir)->default_value("scoreboard.tmp"), "directory for data sets and learner output")
+	("help,h", "produce help message");
+	try
+	{
+		opts::store(opts::command_line_parser(argc, argv).options(desc).run(), vm);
+		opts::notify(vm);
+	}
+	catch (opts::error &err)
+	{
+		cout << "Error:" << err.what() << endl;
+		return 1;
+	}
+	if (vm.count("help"))
+	{
+		cout << desc << endl;
+		return 1;
+	}
+
+	try
+	{
+		learner = absolutePath(learner);
+		generator = absolutePath(generator);
+		workDir = absolutePath(workDir);
+		mkdir(workDir.c_str(), 0755);
+		vector<string> sizes = splitArgs(sizesArg);
+		cout << "nodes\tsamples\trun\twall_s\tpeak_rss_kb\tshd\tauroc\tstatus" << endl;
+		for (size_t s = 0; s < sizes.size(); ++s)
+		{
+			int n = atoi(sizes[s].c_str());
+			for (int run = 0; run < nRuns; ++run)
+			{
+				string dir = str(format("%s/n%d-r%d") % workDir % n % run);
+				mkdir(dir.c_str(), 0755);
+
+				vector<string> genArgs;
+				genArgs.push_back(generator);
+				genArgs.push_back(str(format("--nodes=%d") % n));
+				genArgs.push_back(str(format("--samples=%d") % nSamples));
+				genArgs.push_back(str(format("--max-indegree=%d") % maxIndegree));
+				genArgs.push_back(str(format("--seed=%d") % (1000 * n + run + 1)));
+				genArgs.push_back("--data=data.dat");
+				genArgs.push_back("--graph=truth.dat");
+				if (runCommand(genArgs, dir, "gennet.log").status != 0)
+					throw Exception("Generator failed, see %s/gennet.log") % dir;
+
+				vector<string> args = splitArgs(learnerArgs);
+				args.insert(args.begin(), "data.dat");
+				args.insert(args.begin(), learner);
+				unlink((dir + "/result.dat").c_str());
+				RunResult res = runCommand(args, dir, "learner.log");
+
+				int shd = -1;
+				double auroc = 0;
+				if (res.status == 0)
+				{
+					vector<double> truth = readEdges(dir + "/truth.dat", n);
+					vector<double> posterior = readEdges(dir + "/result.dat", n);
+					shd = structuralHammingDistance(truth, posterior, n, threshold);
+					auroc = edgeAUROC(truth, posterior, n);
+				}
+				cout << format("%d\t%d\t%d\t%.3f\t%d\t%d\t%.4f\t%d") % n % nSamples % run % res.wallTime %
+							res.peakRssKb % shd % auroc % res.status
+					 << endl;
+			}
+		}
+	}
+	catch (Exception &err)
+	{
+		cout << "Error: " << err.what() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,523 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.hpp"
+#include "data.hpp"
+#include "stacksubset.hpp"
+#include "scores.hpp"
+#include "subsetrank.hpp"
+#include "countlattice.hpp"
+#include "samplecodes.hpp"
+#include "hugepages.hpp"
+
+#ifndef SCORECACHE_HPP
+#define SCORECACHE_HPP
+
+/**
+ * FNV-1a hash of the selected columns of a data set.
+ */
+uint64_t hashData(const Data &data, const std::vector<int> &vars)
+{
+	uint64_t h = 14695981039346656037ULL;
+	const uint64_t prime = 1099511628211ULL;
+	int header[2] = {(int)vars.size(), data.getNumSamples()};
+	const unsigned char *p = (const unsigned char *)header;
+	for (size_t i = 0; i < sizeof(header); ++i)
+		h = (h ^ p[i]) * prime;
+	for (size_t v = 0; v < vars.size(); ++v)
+		for (int i = 0; i < data.getNumSamples(); ++i)
+			h = (h ^ data(vars[v], i)) * prime;
+	return h;
+}
+
+/**
+ * Identifies the scores stored in a score store file.
+ */
+struct ScoreStoreKey
+{
+	uint64_t dataHash;
+	std::string scoreName;
+	double ess;
+	int maxParents;
+};
+
+struct ScoreStoreHeader
+{
+	char magic[8];
+	uint64_t dataHash;
+	char scoreName[16];
+	double ess;
+	int32_t maxParents;
+	int32_t nVariables;
+	uint64_t nScores;
+};
+
+static const char SCORE_STORE_MAGIC[8] = {'B', 'N', 'S', 'C', 'O', 'R', 'E', '1'};
+
+/**
+ * On-disk table of local scores in the ranked parent set layout of
+ * LocalScoreCache. The file is mapped read-only, so concurrent runs on the
+ * same data share a single copy through the page cache. Missing entries
+ * are NaN.
+ */
+class ScoreStore
+{
+private:
+	std::string path_;
+	ScoreStoreHeader header_;
+	void *map_;
+	size_t mapSize_;
+
+	ScoreStore(const ScoreStore &);			   // disable copying
+	ScoreStore &operator=(const ScoreStore &); // disable copying
+
+	// maps the file if it exists and matches the header, returns the scores or NULL
+	static const double *mapFile(const std::string &path, const ScoreStoreHeader &header, void *&map, size_t &mapSize)
+	{
+		map = NULL;
+		mapSize = 0;
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return NULL;
+		struct stat st;
+		size_t expected = sizeof(ScoreStoreHeader) + header.nScores * sizeof(double);
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size != expected)
+		{
+			close(fd);
+			return NULL;
+		}
+		void *m = mmap(NULL, expected, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED)
+			return NULL;
+		if (memcmp(m, &header, sizeof(ScoreStoreHeader)) != 0)
+		{
+			munmap(m, expected);
+			return NULL;
+		}
+		map = m;
+		mapSize = expected;
+		return (const double *)((const char *)m + sizeof(ScoreStoreHeader));
+	}
+
+	// save() with the lock held
+	bool saveLocked(const double *scores)
+	{
+		std::vector<double> merged(scores, scores + header_.nScores);
+		void *m;
+		size_t mSize;
+		const double *current = mapFile(path_, header_, m, mSize);
+		if (current)
+		{
+			for (size_t i = 0; i < merged.size(); ++i)
+				if (std::isnan(merged[i]))
+					merged[i] = current[i];
+			munmap(m, mSize);
+		}
+		std::string tmpPath = str(format("%s.tmp.%d") % path_ % getpid());
+		FILE *f = fopen(tmpPath.c_str(), "wb");
+		if (f == NULL)
+			return false;
+		bool ok = fwrite(&header_, sizeof(header_), 1, f) == 1;
+		ok = ok && fwrite(&merged[0], sizeof(double), merged.size(), f) == merged.size();
+		ok = (fclose(f) == 0) && ok;
+		if (!ok || rename(tmpPath.c_str(), path_.c_str()) != 0)
+		{
+			unlink(tmpPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+public:
+	ScoreStore(const std::string &dir, const ScoreStoreKey &key, int nVariables, size_t nScores)
+	{
+		memset(&header_, 0, sizeof(header_));
+		memcpy(header_.magic, SCORE_STORE_MAGIC, 8);
+		header_.dataHash = key.dataHash;
+		strncpy(header_.scoreName, key.scoreName.c_str(), sizeof(header_.scoreName) - 1);
+		header_.ess = key.ess;
+		header_.maxParents = key.maxParents;
+		header_.nVariables = nVariables;
+		header_.nScores = nScores;
+		path_ = str(format("%s/%016x-%s-ess%g-k%d.scores") % dir % key.dataHash % key.scoreName % key.ess % key.maxParents);
+		map_ = NULL;
+		mapSize_ = 0;
+	}
+
+	~ScoreStore()
+	{
+		if (map_)
+			munmap(map_, mapSize_);
+	}
+
+	const std::string &getPath() const
+	{
+		return path_;
+	}
+
+	// maps the stored scores read-only, returns NULL if there is no usable file yet
+	const double *open()
+	{
+		assert(map_ == NULL);
+		return mapFile(path_, header_, map_, mapSize_);
+	}
+
+	/**
+	 * Writes the union of the file currently on disk and the given scores
+	 * (NaN for unknown) next to the store and renames it into place. Runs
+	 * saving the same store at once take turns on an flock of the file
+	 * path.lock, so neither drops the scores the other has just added.
+	 * Returns false if the file could not be written.
+	 */
+	bool save(const double *scores)
+	{
+		std::string lockPath = path_ + ".lock";
+		int lockFd = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+		if (lockFd < 0)
+			return false;
+		int locked;
+		while ((locked = flock(lockFd, LOCK_EX)) != 0 && errno == EINTR)
+			;
+		bool ok = locked == 0 && saveLocked(scores);
+		close(lockFd); // releases the lock
+		return ok;
+	}
+};
+
+/**
+ * Memoizes local scores of parent sets with at most maxParents elements.
+ * For each node the parent sets (subsets of the other n-1 variables) are
+ * stored by their SubsetRanker rank. Scores are always computed with the
+ * parents in ascending order, so a cached value does not depend on the
+ * order in which a caller happened to list the parents.
+ */
+class LocalScoreCache
+{
+private:
+	const DataView &data_;
+	const ScoreFun *scoreFun_;
+	int nVariables_;
+	int maxParents_;
+	SubsetRanker ranker_;
+	size_t nSets_;
+	LargeArray<double> *scoreTable_; // NULL while the scores are kept in sparseScores_
+	double *scores_;		  // nVariables_ x nSets_ computed in this run, NaN if unknown
+	std::unordered_map<size_t, double> sparseScores_; // by table index, until the table is made dense
+	const double *stored_;	// scores from the score store or NULL
+	ScoreStore *store_;
+	size_t nComputed_;
+	size_t nHits_;
+	bool filled_; // every score is known, lookups are read-only
+	SampleCodes sampleCodes_; // counts the lookups that miss, before fill()
+
+	// approximate memory of one entry of sparseScores_: the node with key, value and link, and its bucket
+	static const size_t SPARSE_ENTRY_BYTES = sizeof(std::pair<const size_t, double>) + 2 * sizeof(void *);
+
+	// allocates the dense table and moves the scores computed so far into it
+	void makeDense()
+	{
+		if (scoreTable_)
+			return;
+		scoreTable_ = new LargeArray<double>((size_t)nVariables_ * nSets_);
+		scores_ = scoreTable_->get();
+		for (size_t i = 0; i < nVariables_ * nSets_; ++i)
+			scores_[i] = std::numeric_limits<double>::quiet_NaN();
+		for (std::unordered_map<size_t, double>::const_iterator it = sparseScores_.begin(); it != sparseScores_.end(); ++it)
+			scores_[it->first] = it->second;
+		std::unordered_map<size_t, double>().swap(sparseScores_);
+	}
+
+	// needs the dense table
+	bool isKnown(size_t index) const
+	{
+		return (stored_ && !std::isnan(stored_[index])) || !std::isnan(scores_[index]);
+	}
+
+	/**
+	 * Computes the missing scores of node with a subset of the maximal
+	 * parent set given by mask from one pass over the data, see CountLattice.
+	 * Tables with more cells than samples are cheaper to count directly.
+	 */
+	void fillSubsets(CountLattice &lattice, int node, uint64_t mask, size_t *nComputed)
+	{
+		int items[64];
+		int k = 0;
+		for (; mask; mask &= mask - 1)
+			items[k++] = __builtin_ctzll(mask);
+		StackSubset parents(nVariables_);
+		for (int i = 0; i < k; ++i)
+			parents.push(items[i] < node ? items[i] : items[i] + 1);
+		bool counted = false;
+		bool direct = lattice.getTableSize(parents, node) > (size_t)data_.getNumSamples();
+		StackSubset subset(nVariables_);
+		for (uint32_t sub = 0; sub < ((uint32_t)1 << k); ++sub)
+		{
+			uint64_t subMask = 0;
+			for (int i = 0; i < k; ++i)
+				if (sub & ((uint32_t)1 << i))
+					subMask |= (uint64_t)1 << items[i];
+			size_t index = node * nSets_ + ranker_.rankMask(subMask);
+			if (isKnown(index))
+				continue;
+			if (direct)
+			{
+				subset.clear();
+				for (int i = 0; i < k; ++i)
+					if (sub & ((uint32_t)1 << i))
+						subset.push(parents[i]);
+				scores_[index] = computeScore(&data_, subset, node, scoreFun_);
+			}
+			else
+			{
+				if (!counted)
+					lattice.count(parents, node);
+				counted = true;
+				scores_[index] = lattice.score(sub, scoreFun_);
+			}
+			++*nComputed;
+		}
+	}
+
+	// computes the missing scores of nodes first, first + step, ...
+	void fillNodes(int first, int step, size_t *nComputed)
+	{
+		StackSubset parents(nVariables_);
+		CountLattice lattice(data_);
+		for (int node = first; node < nVariables_; node += step)
+		{
+			// every parent set is a subset of one of the largest ones
+			for (size_t r = ranker_.getSizeOffset(maxParents_); r < nSets_; ++r)
+				fillSubsets(lattice, node, ranker_.unrankMask(r), nComputed);
+			for (size_t r = 0; r < nSets_; ++r)
+			{
+				size_t index = node * nSets_ + r;
+				if (isKnown(index))
+					continue;
+				parents.clear();
+				for (uint64_t mask = ranker_.unrankMask(r); mask; mask &= mask - 1)
+				{
+					int item = __builtin_ctzll(mask);
+					parents.push(item < node ? item : item + 1);
+				}
+				scores_[index] = computeScore(&data_, parents, node, scoreFun_);
+				++*nComputed;
+			}
+		}
+	}
+
+	LocalScoreCache(const LocalScoreCache &);			 // disable copying
+	LocalScoreCache &operator=(const LocalScoreCache &); // disable copying
+
+public:
+	// tables up to this many scores are allocated up front, larger ones by fill() or attachStore()
+	static const size_t MAX_EAGER_SCORES = (size_t)1 << 22;
+
+	/**
+	 * The scores of parent sets with at most maxParents elements. Small
+	 * tables are dense from the start; the scores of larger ones are kept in
+	 * a hash table as they are computed, so a chain that visits a fraction of
+	 * the parent sets does not pay for all of them.
+	 */
+	LocalScoreCache(const DataView &data, const ScoreFun *scoreFun, int maxParents)
+		: data_(data), scoreFun_(scoreFun), nVariables_(data.getNumVariables()),
+		  maxParents_(maxParents < nVariables_ - 1 ? maxParents : nVariables_ - 1),
+		  ranker_(nVariables_ - 1, maxParents_), nSets_(ranker_.getNumSubsets()),
+		  scoreTable_(NULL), scores_(NULL), sampleCodes_(data)
+	{
+		if ((size_t)nVariables_ * nSets_ <= MAX_EAGER_SCORES)
+			makeDense();
+		stored_ = NULL;
+		store_ = NULL;
+		nComputed_ = 0;
+		nHits_ = 0;
+		filled_ = false;
+	}
+
+	~LocalScoreCache()
+	{
+		delete store_;
+		delete scoreTable_;
+	}
+
+	/**
+	 * Takes scores from the store in dir and remembers it for save().
+	 * Returns the number of scores available from the store.
+	 */
+	size_t attachStore(const std::string &dir, const ScoreStoreKey &key)
+	{
+		assert(store_ == NULL);
+		makeDense();
+		store_ = new ScoreStore(dir, key, nVariables_, nVariables_ * nSets_);
+		stored_ = store_->open();
+		size_t nStored = 0;
+		if (stored_)
+			for (size_t i = 0; i < nVariables_ * nSets_; ++i)
+				if (!std::isnan(stored_[i]))
+					++nStored;
+		return nStored;
+	}
+
+	/**
+	 * Computes every score not known yet, on nThreads threads. Afterwards
+	 * lookups neither write nor count hits, so threads can share the cache.
+	 */
+	void fill(int nThreads = 1)
+	{
+		makeDense();
+		std::vector<size_t> computed(nThreads, 0);
+		std::vector<std::thread> threads;
+		for (int t = 1; t < nThreads; ++t)
+			threads.push_back(std::thread(&LocalScoreCache::fillNodes, this, t, nThreads, &computed[t]));
+		fillNodes(0, nThreads, &computed[0]);
+		for (size_t t = 0; t < threads.size(); ++t)
+			threads[t].join();
+		for (int t = 0; t < nThreads; ++t)
+			nComputed_ += computed[t];
+		filled_ = true;
+	}
+
+	// persists newly computed scores to the attached store
+	bool save()
+	{
+		if (store_ == NULL || nComputed_ == 0)
+			return true;
+		return store_->save(scores_);
+	}
+
+	const ScoreStore *getStore() const
+	{
+		return store_;
+	}
+
+	int getNumVariables() const
+	{
+		return nVariables_;
+	}
+
+	int getMaxParents() const
+	{
+		return maxParents_;
+	}
+
+	const ScoreFun *getScoreFun() const
+	{
+		return scoreFun_;
+	}
+
+	size_t getNumParentsets() const
+	{
+		return nSets_;
+	}
+
+	size_t getNumComputed() const
+	{
+		return nComputed_;
+	}
+
+	size_t getNumHits() const
+	{
+		return nHits_;
+	}
+
+	// whether the dense table is allocated
+	bool isDense() const
+	{
+		return scoreTable_ != NULL;
+	}
+
+	// bytes of the dense table of nVariables variables and parent sets of at most maxParents elements
+	static size_t getTableBytes(int nVariables, int maxParents)
+	{
+		if (maxParents > nVariables - 1)
+			maxParents = nVariables - 1;
+		return (size_t)nVariables * SubsetRanker(nVariables - 1, maxParents).getNumSubsets() * sizeof(double);
+	}
+
+	// memory taken by the scores, at most getTableBytes(getNumVariables(), getMaxParents())
+	size_t getNumBytes() const
+	{
+		if (scoreTable_)
+			return (size_t)nVariables_ * nSets_ * sizeof(double);
+		return sparseScores_.size() * SPARSE_ENTRY_BYTES;
+	}
+
+	const SubsetRanker &getRanker() const
+	{
+		return ranker_;
+	}
+
+	// position of (parents, node) in the score table
+	size_t getIndex(const StackSubset &parents, int node) const
+	{
+		assert(parents.size() <= (size_t)maxParents_);
+		int items[64];
+		int size = parents.size();
+		for (int i = 0; i < size; ++i)
+		{
+			assert(parents[i] != node);
+			items[i] = parents[i] < node ? parents[i] : parents[i] - 1;
+		}
+		std::sort(items, items + size);
+		return node * nSets_ + ranker_.rank(items, size);
+	}
+
+	double operator()(const StackSubset &parents, int node)
+	{
+		size_t index = getIndex(parents, node);
+		if (filled_)
+			return stored_ && !std::isnan(stored_[index]) ? stored_[index] : scores_[index];
+		if (stored_ && !std::isnan(stored_[index]))
+		{
+			++nHits_;
+			return stored_[index];
+		}
+		if (scores_ && !std::isnan(scores_[index]))
+		{
+			++nHits_;
+			return scores_[index];
+		}
+		if (!scores_)
+		{
+			std::unordered_map<size_t, double>::const_iterator it = sparseScores_.find(index);
+			if (it != sparseScores_.end())
+			{
+				++nHits_;
+				return it->second;
+			}
+		}
+		StackSubset sorted(parents);
+		if (sorted.size() > 1)
+			std::sort(&sorted[0], &sorted[0] + sorted.size());
+		double score = sampleCodes_.isSupported() ? computeScore(sampleCodes_, &data_, sorted, node, scoreFun_)
+												  : computeScore(&data_, sorted, node, scoreFun_);
+		if (scores_)
+			scores_[index] = score;
+		else
+		{
+			sparseScores_[index] = score;
+			// the hash table never takes more memory than the dense table would
+			if (sparseScores_.size() * SPARSE_ENTRY_BYTES >= getTableBytes(nVariables_, maxParents_))
+				makeDense();
+		}
+		++nComputed_;
+		return score;
+	}
+};
+
+#endif
@@ -2,18 +2,48 @@
 
 #include "data.hpp"
 #include "stacksubset.hpp"
+#include "metrics.hpp"
 
 
 #ifndef SCORES_HPP
 #define SCORES_HPP
 
 
+// lgamma without writing the global signgam, so that scores can be computed on several threads
+inline double logGamma(double x) {
+	int sign;
+	return lgamma_r(x, &sign);
+}
+
+
 class ScoreFun {
 public:
 	virtual double compute(int nValues, int nParentValues, int* counts) const = 0;
+	
+	/**
+	 * Upper bound of compute() over all count tables with nParentValues
+	 * parent configurations of which at least minNonzero have samples. Must
+	 * not increase when nParentValues or minNonzero grows, so that a bound
+	 * of a parent set also bounds its supersets. The default gives no bound.
+	 */
+	virtual double upperBound(int, int, int) const {
+		return 1.0 / 0.0;
+	}
+	
 	virtual ~ScoreFun() {};
 };
 
+/**
+ * Bound of the Bayesian Dirichlet scores with a uniform prior over the
+ * values of the node (BDeu, K2). The term of a parent configuration is the
+ * log marginal likelihood of its samples, whose first sample has predictive
+ * probability 1/nValues and the rest at most 1, so every non-empty
+ * configuration contributes at most -log(nValues).
+ */
+inline double uniformDirichletBound(int nValues, int minNonzero) {
+	return -minNonzero * log(nValues);
+}
+
 
 /**
  * BDeu score function.
@@ -33,13 +63,16 @@ public:
 			int cumCount = 0;
 			for (int v = 0; v < nValues; ++v) {
 				int c = counts[pv * nValues + v];
-				score += lgamma(c + pseudocount) - lgamma(pseudocount);
+				score += logGamma(c + pseudocount) - logGamma(pseudocount);
 				cumCount += c;
 			}
-			score += lgamma(parentPseudocount) - lgamma(cumCount + parentPseudocount);
+			score += logGamma(parentPseudocount) - logGamma(cumCount + parentPseudocount);
 		}
 		return score;
 	}
+	double upperBound(int nValues, int, int minNonzero) const {
+		return uniformDirichletBound(nValues, minNonzero);
+	}
 };
 
 /**
@@ -82,6 +115,9 @@ public:
 		}
 		return score;
 	}
+	double upperBound(int nValues, int, int minNonzero) const {
+		return uniformDirichletBound(nValues, minNonzero);
+	}
 };
 
 
@@ -96,13 +132,16 @@ public:
 			int cumCount = 0;
 			for (int v = 0; v < nValues; ++v) {
 				int c = counts[pv * nValues + v];
-				score += lgamma(c + 1);
+				score += logGamma(c + 1);
 				cumCount += c;
 			}
-			score += lgamma(nValues) - lgamma(cumCount + nValues);
+			score += logGamma(nValues) - logGamma(cumCount + nValues);
 		}
 		return score;
 	}
+	double upperBound(int nValues, int, int minNonzero) const {
+		return uniformDirichletBound(nValues, minNonzero);
+	}
 };
 
 /**
@@ -135,6 +174,9 @@ public:
 		}
 		return score;
 	}
+	double upperBound(int nValues, int, int minNonzero) const {
+		return uniformDirichletBound(nValues, minNonzero);
+	}
 };
 
 
@@ -163,6 +205,9 @@ public:
 	double compute(int nValues, int nParentValues, int* counts) const {
 		return computeLLScore(nValues, nParentValues, counts);
 	}
+	double upperBound(int, int, int) const {
+		return 0;
+	}
 };
 
 
@@ -179,6 +224,10 @@ public:
 	double compute(int nValues, int nParentValues, int* counts) const {
 		return computeLLScore(nValues, nParentValues, counts) - .5 * log(nSamples_) * (nValues - 1) * nParentValues;
 	}
+	// the log-likelihood is at most 0
+	double upperBound(int nValues, int nParentValues, int) const {
+		return -.5 * log(nSamples_) * (nValues - 1) * nParentValues;
+	}
 };
 
 
@@ -190,6 +239,10 @@ public:
 	double compute(int nValues, int nParentValues, int* counts) const {
 		return computeLLScore(nValues, nParentValues, counts) - (nValues - 1) * nParentValues;
 	}
+	// the log-likelihood is at most 0
+	double upperBound(int nValues, int nParentValues, int) const {
+		return -(nValues - 1) * nParentValues;
+	}
 };
 
 
@@ -336,14 +389,23 @@ double computeScore(const DataView* dataView, const StackSubset& parents, int no
 	for (int i = 0; i < parents.size(); ++i)
 		vars[i] = parents[i];
 	vars[parents.size()] = node;
-	int* counts = dataView->getCounts(vars);
+	metrics.countComputeScore();
+	int* counts;
+	{
+		PhaseTimer timer(PHASE_COUNTING);
+		counts = dataView->getCounts(vars);
+	}
 	// compute score
 	int nParentValues = 1;
 	for (int i = 0; i < parents.size(); ++i)
 		nParentValues *= dataView->getArity(parents[i]);
 	int nNodeValues = dataView->getArity(node);
 	// std::cout<<nNodeValues<<" "<<nParentValues<<std::endl;
-	double score = scoreFun->compute(nNodeValues, nParentValues, counts);
+	double score;
+	{
+		PhaseTimer timer(PHASE_SCORING);
+		score = scoreFun->compute(nNodeValues, nParentValues, counts);
+	}
 	delete[] counts;
 	return score;
 }/**/
@@ -0,0 +1,85 @@
+// Resident learning server: keeps data sets and their local scores in
+// memory and runs jobs sent over a Unix domain socket, see server.hpp for
+// the requests. With --query it sends one request to a running server and
+// prints the reply instead.
+
+#include <iostream>
+#include <string>
+#include <thread>
+#include <csignal>
+#include "common.hpp"
+#include "logger.hpp"
+#include "server.hpp"
+#include <boost/program_options.hpp>
+using namespace std;
+namespace opts = boost::program_options;
+
+static JobServer *runningServer = NULL;
+
+static void stopServer(int)
+{
+	if (runningServer)
+		runningServer->stop();
+}
+
+int main(int argc, char **argv)
+{
+	string socketPath;
+	string query;
+	int nThreads;
+	size_t maxQueued;
+	size_t memoryMB;
+	int maxParents;
+	int verbosity;
+	int defaultThreads = thread::hardware_concurrency() > 0 ? thread::hardware_concurrency() : 1;
+	opts::options_description desc("Options");
+	opts::variables_map vm;
+	desc.add_options()
+	("socket,S", opts::value<string>(&socketPath)->default_value("bnsl.sock"), "path of the Unix domain socket")
+	("threads,t", opts::value<int>(&nThreads)->default_value(defaultThreads), "number of worker threads")
+	("queue,q", opts::value<size_t>(&maxQueued)->default_value(64), "number of waiting jobs beyond which requests are rejected")
+	("memory,M", opts::value<size_t>(&memoryMB)->default_value(4096), "memory budget of the local score caches in MB")
+	("max-parents", opts::value<int>(&maxParents)->default_value(8), "largest m a request may ask for")
+	("query", opts::value<string>(&query), "send this request to the server and print the reply")
+	("verbosity,v", opts::value<int>(&verbosity)->default_value(1), "0 errors only, 1 progress, 2 every request on stderr")
+	("help,h", "produce help message");
+	try
+	{
+		opts::store(opts::command_line_parser(argc, argv).options(desc).run(), vm);
+		opts::notify(vm);
+	}
+	catch (opts::error &err)
+	{
+		cerr << "Error:" << err.what() << endl;
+		return 1;
+	}
+	if (vm.count("help"))
+	{
+		cerr << desc << endl;
+		return 1;
+	}
+	if (nThreads < 1)
+	{
+		cerr << "Error: at least one worker thread is needed" << endl;
+		return 1;
+	}
+	try
+	{
+		if (vm.count("query"))
+			return queryServer(socketPath, query, cout) ? 0 : 1;
+		logger.setVerbosity(verbosity);
+		logger.installCrashHandlers();
+		JobServer server(socketPath, nThreads, maxQueued, memoryMB << 20, maxParents);
+		runningServer = &server;
+		signal(SIGINT, stopServer);
+		signal(SIGTERM, stopServer);
+		server.serve();
+		runningServer = NULL;
+	}
+	catch (Exception &err)
+	{
+		cerr << "Error: " << err.what() << endl;
+		return 1;
+	}
+	return 0;
+}
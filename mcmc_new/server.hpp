@@ -0,0 +1,648 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "common.hpp"
+#include "bitmatrix.hpp"
+#include "moves.hpp"
+#include "order.hpp"
+#include "session.hpp"
+#include "logger.hpp"
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+/*
+ * Requests are single lines of whitespace-separated words; the first word
+ * is the command and data commands take the path of a data file next,
+ * followed by key=value settings:
+ *   mcmc <data> [burn=1000] [m=3] [s=5] [seed=0] [moves=block] [prune=0] [memo=65536]
+ *   dp <data> [m=3]
+ *   order2dag <data> order=3,0,2,1 [m=3]
+ *   unload <data>
+ *   stats
+ *   shutdown
+ * Every reply line starts with a word saying what it is: "progress ...",
+ * "order ...", "score ...", "samples ..." and result.dat lines
+ * "i --> j value", and the last line is "ok <seconds>" or "error <message>".
+ */
+
+// writes all of line and a newline to fd; false if the client has gone away
+bool writeLine(int fd, const std::string &line)
+{
+	std::string bytes = line + "\n";
+	size_t done = 0;
+	while (done < bytes.size())
+	{
+		ssize_t n = send(fd, bytes.data() + done, bytes.size() - done, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+// reads up to and without the first newline, at most maxSize bytes; false on end of stream or timeout
+bool readLine(int fd, std::string &line, size_t maxSize = 1 << 16)
+{
+	line.clear();
+	char c;
+	while (line.size() < maxSize)
+	{
+		ssize_t n = recv(fd, &c, 1, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return !line.empty();
+		if (c == '\n')
+			return true;
+		line += c;
+	}
+	return true;
+}
+
+sockaddr_un socketAddress(const std::string &path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		throw Exception("Socket path %s is too long") % path;
+	strcpy(addr.sun_path, path.c_str());
+	return addr;
+}
+
+// a parsed request: command, data path and settings
+struct Request
+{
+	std::string command;
+	std::string dataPath;
+	std::map<std::string, std::string> settings;
+
+	Request(const std::string &line)
+	{
+		std::istringstream in(line);
+		in >> command;
+		std::string word;
+		if (command != "stats" && command != "shutdown")
+			in >> dataPath;
+		while (in >> word)
+		{
+			size_t eq = word.find('=');
+			if (eq == std::string::npos)
+				throw Exception("Expected key=value instead of %s") % word;
+			settings[word.substr(0, eq)] = word.substr(eq + 1);
+		}
+		if (command.empty())
+			throw Exception("Empty request");
+		if (command != "stats" && command != "shutdown" && dataPath.empty())
+			throw Exception("%s needs a data file") % command;
+	}
+
+	bool has(const std::string &key) const
+	{
+		return settings.count(key) > 0;
+	}
+
+	std::string get(const std::string &key, const std::string &def) const
+	{
+		std::map<std::string, std::string>::const_iterator it = settings.find(key);
+		return it == settings.end() ? def : it->second;
+	}
+
+	long getInt(const std::string &key, long def) const
+	{
+		if (!has(key))
+			return def;
+		std::string value = get(key, "");
+		char *end;
+		long v = strtol(value.c_str(), &end, 10);
+		if (value.empty() || *end != '\0')
+			throw Exception("%s=%s is not an integer") % key % value;
+		return v;
+	}
+
+	// rejects settings the command does not know
+	void check(const char *const *known, size_t nKnown) const
+	{
+		for (std::map<std::string, std::string>::const_iterator it = settings.begin(); it != settings.end(); ++it)
+		{
+			size_t k = 0;
+			while (k < nKnown && it->first != known[k])
+				++k;
+			if (k == nKnown)
+				throw Exception("Unknown setting %s for %s") % it->first % command;
+		}
+	}
+};
+
+/**
+ * Serves learning jobs over a Unix domain socket. Data sets are loaded on
+ * first use and stay resident as Sessions, so later jobs on the same data
+ * find the local scores, pruned candidates and optimal orders of the
+ * earlier ones. Connections carry one request each. The accepting thread
+ * queues connections for a fixed pool of worker threads, which read the
+ * requests, so a slow client holds up only its own worker; when maxQueued
+ * jobs are already waiting, the connection is turned away at once with
+ * "error busy" instead of piling up. Jobs on the same data set run one at
+ * a time, jobs on different data sets in parallel. A job whose client
+ * stops reading or goes away is abandoned at its next progress report.
+ *
+ * Local score caches grow with the data and m, so m is capped at
+ * maxParents and the caches of all data sets share a memory budget. Before
+ * a job starts, the memory it may add (Session::estimateQueryBytes) is
+ * reserved; if that does not fit, the caches of the least recently used
+ * idle data sets are freed, then those of the job's own data set for other
+ * bounds, and if it still does not fit the job is rejected.
+ */
+class JobServer
+{
+private:
+	struct Dataset
+	{
+		std::mutex mutex; // held by the job using the session
+		Session *session;
+		bool unloaded;	  // removed from datasets_ while a job still held it
+		// guarded by datasetsMutex_
+		size_t nBytes;	  // memory of the local scores after the last job
+		size_t nReserved; // memory the running job may add
+		uint64_t lastUsed;
+		Dataset() : session(NULL), unloaded(false), nBytes(0), nReserved(0), lastUsed(0) {}
+		~Dataset()
+		{
+			delete session;
+		}
+	};
+
+	typedef std::shared_ptr<Dataset> DatasetPtr;
+
+	struct Job
+	{
+		int fd;
+		std::chrono::steady_clock::time_point received;
+	};
+
+	std::string socketPath_;
+	int listenFd_;
+	size_t maxQueued_;
+	std::deque<Job> queue_;
+	std::mutex queueMutex_;
+	std::condition_variable queueCond_;
+	std::atomic<bool> stop_;
+	std::vector<std::thread> workers_;
+	std::mutex datasetsMutex_;
+	std::map<std::string, DatasetPtr> datasets_;
+	size_t memoryBudget_;
+	int maxParents_;
+	uint64_t useClock_; // guarded by datasetsMutex_
+	std::atomic<uint64_t> nServed_;
+	std::atomic<uint64_t> nFailed_;
+	std::atomic<uint64_t> nRejected_;
+	std::atomic<int> nRunning_;
+
+	JobServer(const JobServer &);			 // disable copying
+	JobServer &operator=(const JobServer &); // disable copying
+
+	static double secondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the entry of path, created on first use; the session is loaded by the job that locks it first
+	DatasetPtr getDataset(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(datasetsMutex_);
+		std::map<std::string, DatasetPtr>::iterator it = datasets_.find(path);
+		if (it == datasets_.end())
+			it = datasets_.insert(std::make_pair(path, DatasetPtr(new Dataset()))).first;
+		return it->second;
+	}
+
+	// memory of all caches and reservations; needs datasetsMutex_
+	size_t getMemoryUsed() const
+	{
+		size_t nBytes = 0;
+		for (std::map<std::string, DatasetPtr>::const_iterator it = datasets_.begin(); it != datasets_.end(); ++it)
+			nBytes += it->second->nBytes + it->second->nReserved;
+		return nBytes;
+	}
+
+	static double toMB(size_t nBytes)
+	{
+		return nBytes / (double)(1 << 20);
+	}
+
+	/**
+	 * Reserves the memory of a query with at most maxParents parents on the
+	 * session of dataset, whose mutex the caller holds, evicting caches as
+	 * needed (see the class comment); throws if the budget cannot hold it.
+	 */
+	void admit(Dataset &dataset, int maxParents, bool exact)
+	{
+		Session &session = *dataset.session;
+		size_t nBytes = session.estimateQueryBytes(maxParents, exact);
+		std::lock_guard<std::mutex> lock(datasetsMutex_);
+		dataset.nBytes = session.getNumBytes();
+		// what stays in use however much is evicted: the data sets of running jobs and the bound of this one
+		size_t kept = session.getNumBytes(maxParents);
+		for (std::map<std::string, DatasetPtr>::iterator it = datasets_.begin(); it != datasets_.end(); ++it)
+			if (it->second.get() != &dataset && it->second->nReserved)
+				kept += it->second->nBytes + it->second->nReserved;
+		if (kept + nBytes > memoryBudget_)
+			throw Exception("The job needs about %.1f MB, %.1f of the %.1f MB budget are in use") % toMB(nBytes) %
+				toMB(getMemoryUsed()) % toMB(memoryBudget_);
+		while (getMemoryUsed() + nBytes > memoryBudget_)
+		{
+			// the least recently used other data set whose job, if any, has finished
+			Dataset *victim = NULL;
+			std::unique_lock<std::mutex> victimLock;
+			for (std::map<std::string, DatasetPtr>::iterator it = datasets_.begin(); it != datasets_.end(); ++it)
+			{
+				Dataset *other = it->second.get();
+				if (other == &dataset || other->nBytes == 0 || (victim && other->lastUsed >= victim->lastUsed))
+					continue;
+				std::unique_lock<std::mutex> otherLock(other->mutex, std::try_to_lock);
+				if (!otherLock.owns_lock() || other->session == NULL)
+					continue;
+				victim = other;
+				victimLock = std::move(otherLock);
+			}
+			if (victim)
+			{
+				logger.printfln(1, "evicting %.1f MB of local scores", toMB(victim->nBytes));
+				victim->session->evictLocalScores(-1);
+				victim->nBytes = victim->session->getNumBytes();
+				continue;
+			}
+			if (dataset.nBytes > session.getNumBytes(maxParents))
+			{
+				session.evictLocalScores(maxParents);
+				dataset.nBytes = session.getNumBytes();
+				continue;
+			}
+			// the rest belongs to data sets whose jobs are just starting or finishing
+			throw Exception("The job needs about %.1f MB, %.1f of the %.1f MB budget are in use") % toMB(nBytes) %
+				toMB(getMemoryUsed()) % toMB(memoryBudget_);
+		}
+		dataset.nReserved = nBytes;
+		dataset.lastUsed = ++useClock_;
+	}
+
+	// replaces the reservation of the finished job with what the caches now take
+	void release(Dataset &dataset)
+	{
+		std::lock_guard<std::mutex> lock(datasetsMutex_);
+		dataset.nBytes = dataset.session ? dataset.session->getNumBytes() : 0;
+		dataset.nReserved = 0;
+	}
+
+	void writeEdges(int fd, const BitMatrix &dag)
+	{
+		int n = dag.getNumNodes();
+		for (int i = 0; i < n; ++i)
+			for (int j = 0; j < n; ++j)
+				writeLine(fd, str(format("%d --> %d %s") % i % j % (dag(i, j) ? "1.000" : "0.000")));
+	}
+
+	static std::string formatOrder(const std::vector<int> &order)
+	{
+		std::ostringstream out;
+		out << "order";
+		for (size_t i = 0; i < order.size(); ++i)
+			out << " " << order[i];
+		return out.str();
+	}
+
+	void runMCMC(int fd, const Request &request, Session &session)
+	{
+		static const char *const known[] = {"burn", "m", "s", "seed", "moves", "prune", "memo"};
+		request.check(known, sizeof(known) / sizeof(known[0]));
+		MCMCOptions options;
+		options.burnIn = request.getInt("burn", 1000);
+		options.maxParentSize = request.getInt("m", 3);
+		options.swapN = request.getInt("s", 5);
+		options.seed = request.getInt("seed", 0);
+		options.pruneParents = request.getInt("prune", 0) != 0;
+		options.blockMemoSize = request.getInt("memo", 65536);
+		parseMoveMixture(request.get("moves", "block"), options.moveWeights);
+		int n = session.getNumVariables();
+		if (options.burnIn < 0 || options.maxParentSize < 0 || options.swapN < 1 || options.swapN > n)
+			throw Exception("Need burn >= 0, m >= 0 and 1 <= s <= %d") % n;
+		std::chrono::steady_clock::time_point lastProgress = std::chrono::steady_clock::now();
+		options.progress = [&](int done, int total) {
+			if (secondsSince(lastProgress) < 0.5)
+				return;
+			lastProgress = std::chrono::steady_clock::now();
+			if (!writeLine(fd, str(format("progress iteration %d of %d") % done % total)))
+				throw Exception("Client has gone away");
+		};
+		OrderMCMCResult result(n);
+		session.runOrderMCMC(options, result);
+		writeLine(fd, str(format("samples %d") % result.sampleCount));
+		for (int i = 0; i < n; ++i)
+			for (int j = 0; j < n; ++j)
+			{
+				std::ostringstream line;
+				line << i << " --> " << j << " " << std::setprecision(3) << std::fixed << result.getEdgePosterior(i, j);
+				writeLine(fd, line.str());
+			}
+	}
+
+	void runDP(int fd, const Request &request, Session &session)
+	{
+		static const char *const known[] = {"m"};
+		request.check(known, sizeof(known) / sizeof(known[0]));
+		BitMatrix dag(session.getNumVariables());
+		std::vector<int> order;
+		double score = session.findBestDAG(request.getInt("m", 3), dag, &order);
+		writeLine(fd, formatOrder(order));
+		writeLine(fd, str(format("score %.10g") % score));
+		writeEdges(fd, dag);
+	}
+
+	void runOrder2dag(int fd, const Request &request, Session &session)
+	{
+		static const char *const known[] = {"order", "m"};
+		request.check(known, sizeof(known) / sizeof(known[0]));
+		int n = session.getNumVariables();
+		std::vector<int> order;
+		std::vector<bool> seen(n, false);
+		std::istringstream in(request.get("order", ""));
+		std::string item;
+		while (std::getline(in, item, ','))
+		{
+			char *end;
+			long v = strtol(item.c_str(), &end, 10);
+			if (item.empty() || *end != '\0' || v < 0 || v >= n || seen[v])
+				throw Exception("order must list each of the %d variables once") % n;
+			seen[v] = true;
+			order.push_back(v);
+		}
+		if ((int)order.size() != n)
+			throw Exception("order must list each of the %d variables once") % n;
+		BitMatrix dag(n);
+		double score = session.order2dag(order, request.getInt("m", 3), dag);
+		writeLine(fd, str(format("score %.10g") % score));
+		writeEdges(fd, dag);
+	}
+
+	void runStats(int fd)
+	{
+		std::lock_guard<std::mutex> lock(datasetsMutex_);
+		for (std::map<std::string, DatasetPtr>::iterator it = datasets_.begin(); it != datasets_.end(); ++it)
+		{
+			// a data set in use is reported without its numbers rather than waited for
+			std::unique_lock<std::mutex> busy(it->second->mutex, std::try_to_lock);
+			if (!busy.owns_lock())
+				writeLine(fd, str(format("dataset %s busy") % it->first));
+			else if (it->second->session)
+				writeLine(fd, str(format("dataset %s variables %d scores %d memory %.1f MB") % it->first %
+								  it->second->session->getNumVariables() % it->second->session->getNumComputedScores() %
+								  toMB(it->second->nBytes)));
+		}
+		writeLine(fd, str(format("memory %.1f of %.1f MB") % toMB(getMemoryUsed()) % toMB(memoryBudget_)));
+		size_t nQueued;
+		{
+			std::lock_guard<std::mutex> queueLock(queueMutex_);
+			nQueued = queue_.size();
+		}
+		writeLine(fd, str(format("jobs served %d failed %d rejected %d running %d queued %d") % nServed_.load() %
+						  nFailed_.load() % nRejected_.load() % (nRunning_.load() - 1) % nQueued));
+	}
+
+	void runUnload(const Request &request)
+	{
+		DatasetPtr dataset;
+		{
+			std::lock_guard<std::mutex> lock(datasetsMutex_);
+			std::map<std::string, DatasetPtr>::iterator it = datasets_.find(request.dataPath);
+			if (it == datasets_.end())
+				throw Exception("%s is not loaded") % request.dataPath;
+			dataset = it->second;
+			datasets_.erase(it);
+		}
+		// its caches and any reservation leave the budget with it
+		// waits for the job using it; jobs that found it before the erase load the data anew
+		std::lock_guard<std::mutex> busy(dataset->mutex);
+		dataset->unloaded = true;
+		delete dataset->session;
+		dataset->session = NULL;
+	}
+
+	void runData(int fd, const Request &request)
+	{
+		DatasetPtr dataset;
+		std::unique_lock<std::mutex> lock;
+		do
+		{
+			dataset = getDataset(request.dataPath);
+			lock = std::unique_lock<std::mutex>(dataset->mutex);
+		} while (dataset->unloaded);
+		if (dataset->session == NULL)
+		{
+			std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+			dataset->session = new Session(request.dataPath);
+			writeLine(fd, str(format("progress loaded %s: %d variables in %.3f s") % request.dataPath %
+							  dataset->session->getNumVariables() % secondsSince(loadStart)));
+		}
+		long maxParents = request.getInt("m", 3);
+		if (maxParents < 0 || maxParents > maxParents_)
+			throw Exception("Need 0 <= m <= %d") % maxParents_;
+		admit(*dataset, maxParents, request.command == "dp");
+		try
+		{
+			if (request.command == "mcmc")
+				runMCMC(fd, request, *dataset->session);
+			else if (request.command == "dp")
+				runDP(fd, request, *dataset->session);
+			else
+				runOrder2dag(fd, request, *dataset->session);
+		}
+		catch (...)
+		{
+			release(*dataset);
+			throw;
+		}
+		release(*dataset);
+	}
+
+	void runJob(const Job &job)
+	{
+		int fd = job.fd;
+		std::string line;
+		if (!readLine(fd, line))
+		{
+			close(fd);
+			return;
+		}
+		logger.printfln(2, "request: %s", line.c_str());
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		try
+		{
+			Request request(line);
+			writeLine(fd, str(format("progress started after %.3f s in the queue") % secondsSince(job.received)));
+			if (request.command == "stats")
+				runStats(fd);
+			else if (request.command == "shutdown")
+				stop();
+			else if (request.command == "unload")
+				runUnload(request);
+			else if (request.command == "mcmc" || request.command == "dp" || request.command == "order2dag")
+				runData(fd, request);
+			else
+				throw Exception("Unknown command %s") % request.command;
+			writeLine(fd, str(format("ok %.3f") % secondsSince(start)));
+			++nServed_;
+		}
+		catch (Exception &err)
+		{
+			writeLine(fd, std::string("error ") + err.what());
+			++nFailed_;
+		}
+		catch (std::exception &err)
+		{
+			writeLine(fd, std::string("error ") + err.what());
+			++nFailed_;
+		}
+		close(fd);
+	}
+
+	void work()
+	{
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(queueMutex_);
+				while (queue_.empty() && !stop_)
+					queueCond_.wait(lock);
+				if (queue_.empty())
+					return;
+				job = queue_.front();
+				queue_.pop_front();
+				++nRunning_;
+			}
+			runJob(job);
+			--nRunning_;
+		}
+	}
+
+public:
+	JobServer(const std::string &socketPath, int nThreads, size_t maxQueued, size_t memoryBudget, int maxParents)
+		: socketPath_(socketPath), maxQueued_(maxQueued), stop_(false), memoryBudget_(memoryBudget),
+		  maxParents_(maxParents), useClock_(0), nServed_(0), nFailed_(0), nRejected_(0), nRunning_(0)
+	{
+		sockaddr_un addr = socketAddress(socketPath);
+		listenFd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listenFd_ < 0)
+			throw Exception("Could not create a socket: %s") % strerror(errno);
+		// a socket file left behind by a server that died is replaced
+		unlink(socketPath.c_str());
+		if (bind(listenFd_, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd_, 64) != 0)
+		{
+			std::string reason = strerror(errno);
+			close(listenFd_);
+			throw Exception("Could not listen on %s: %s") % socketPath % reason;
+		}
+		for (int t = 0; t < nThreads; ++t)
+			workers_.push_back(std::thread(&JobServer::work, this));
+	}
+
+	~JobServer()
+	{
+		stop();
+		queueCond_.notify_all();
+		for (size_t t = 0; t < workers_.size(); ++t)
+			workers_[t].join();
+		close(listenFd_);
+		unlink(socketPath_.c_str());
+	}
+
+	// makes serve() return; queued jobs are still run
+	void stop()
+	{
+		stop_ = true;
+		shutdown(listenFd_, SHUT_RDWR);
+	}
+
+	// accepts connections until stop()
+	void serve()
+	{
+		logger.printfln(1, "serving on %s", socketPath_.c_str());
+		while (!stop_)
+		{
+			int fd = accept(listenFd_, NULL, NULL);
+			if (fd < 0)
+			{
+				if (errno != EINTR && !stop_)
+					logger.printfln(0, "accept: %s", strerror(errno));
+				continue;
+			}
+			// a client that does not send its request, or stops reading replies, frees its worker in time
+			timeval timeout = {5, 0};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			Job job;
+			job.fd = fd;
+			job.received = std::chrono::steady_clock::now();
+			{
+				std::lock_guard<std::mutex> lock(queueMutex_);
+				if (queue_.size() < maxQueued_)
+				{
+					queue_.push_back(job);
+					queueCond_.notify_one();
+					continue;
+				}
+			}
+			++nRejected_;
+			writeLine(fd, str(format("error busy: %d jobs queued") % maxQueued_));
+			close(fd);
+		}
+	}
+};
+
+// sends request to the server at socketPath and copies the reply to out; false if it ends in an error
+bool queryServer(const std::string &socketPath, const std::string &request, std::ostream &out)
+{
+	sockaddr_un addr = socketAddress(socketPath);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		std::string reason = strerror(errno);
+		if (fd >= 0)
+			close(fd);
+		throw Exception("Could not connect to %s: %s") % socketPath % reason;
+	}
+	// a busy server replies and hangs up without reading the request, so the reply is read even if sending failed
+	bool sent = writeLine(fd, request);
+	std::string line, last;
+	while (readLine(fd, line))
+	{
+		out << line << std::endl;
+		last = line;
+	}
+	close(fd);
+	if (!sent && last.empty())
+		throw Exception("Could not send the request to %s") % socketPath;
+	return last.compare(0, 3, "ok ") == 0;
+}
+
+#endif
@@ -0,0 +1,312 @@
+#include <fstream>
+#include <istream>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "common.hpp"
+#include "lognum.hpp"
+#include "data.hpp"
+#include "scores.hpp"
+#include "stacksubset.hpp"
+#include "scorecache.hpp"
+#include "bestdagdp.hpp"
+#include "pruning.hpp"
+#include "bitmatrix.hpp"
+#include "order.hpp"
+
+#ifndef SESSION_HPP
+#define SESSION_HPP
+
+// fills the sparse score table of the exact search from a local score cache
+void computeScores(LocalScoreCache &localScores, SparseParentsetMap<Real> &scores)
+{
+	int n = localScores.getNumVariables();
+	StackSubset parents(n);
+	for (int i = 0; i < n; ++i)
+	{
+		for (size_t j = 0; j < scores.getNumParentsets(); ++j)
+		{
+			size_t pa = scores.getParentset(j);
+			if (pa & ((size_t)1 << i))
+				continue;
+			parents.clear();
+			for (int v = 0; v < n; ++v)
+				if (pa & ((size_t)1 << v))
+					parents.push(v);
+			Lognum<double> tmp;
+			tmp.setLog(localScores(parents, i));
+			scores(i, j) = to<Real>(tmp);
+		}
+	}
+}
+
+// fills the dense log-score table of the exact search from a local score cache
+void computeLogScores(LocalScoreCache &localScores, ParentsetMap<double> &logScores)
+{
+	int n = localScores.getNumVariables();
+	int maxParents = localScores.getMaxParents();
+	StackSubset parents(n);
+	for (int i = 0; i < n; ++i)
+	{
+		double *row = logScores.getRow(i);
+		for (size_t pa = 0; pa < ((size_t)1 << n); ++pa)
+		{
+			parents.clear();
+			for (int v = 0; v < n; ++v)
+				if (pa & ((size_t)1 << v))
+					parents.push(v);
+			if (parents.contains(i) || parents.size() > (size_t)maxParents)
+				row[pa] = -std::numeric_limits<double>::infinity();
+			else
+				row[pa] = localScores(parents, i);
+		}
+	}
+}
+
+/**
+ * A data set loaded once, together with what is computed from it, for
+ * programs that run many queries against the same data. The session owns
+ * the data, the score function, one local score cache and one set of
+ * pruned candidates per in-degree bound, and the optimal orders found so
+ * far, so a query pays only for the scores no earlier query needed.
+ * Results stay in memory; nothing is written to result.dat. Queries of a
+ * session must not run concurrently.
+ */
+class Session
+{
+private:
+	Data data_;
+	std::vector<int> targets_;
+	DataColumns *columns_;
+	BDeuScore scoreFun_;
+	std::map<int, LocalScoreCache *> localScores_; // by in-degree bound
+	std::map<int, CandidateParentSets *> candidates_;
+	std::map<int, std::vector<int> > bestOrders_;
+
+	Session(const Session &);			 // disable copying
+	Session &operator=(const Session &); // disable copying
+
+	void init()
+	{
+		for (int i = 0; i < data_.getNumVariables(); ++i)
+			targets_.push_back(i);
+		columns_ = new DataColumns(data_, targets_);
+	}
+
+	// in-degree bounds above n - 1 all mean the same parent sets
+	int clampMaxParents(int maxParents) const
+	{
+		if (maxParents < 0)
+			throw Exception("Invalid maximum parent set size %d") % maxParents;
+		int n = data_.getNumVariables();
+		return maxParents < n - 1 ? maxParents : (n > 0 ? n - 1 : 0);
+	}
+
+public:
+	// loads the data file at path, in the format of main
+	Session(const std::string &path, double equivalentSampleSize = 1) : scoreFun_(equivalentSampleSize)
+	{
+		std::ifstream in(path.c_str());
+		if (!in)
+			throw Exception("Could not open %s") % path;
+		data_.read(in);
+		init();
+	}
+
+	Session(std::istream &in, double equivalentSampleSize = 1) : scoreFun_(equivalentSampleSize)
+	{
+		data_.read(in);
+		init();
+	}
+
+	~Session()
+	{
+		for (std::map<int, LocalScoreCache *>::iterator it = localScores_.begin(); it != localScores_.end(); ++it)
+			delete it->second;
+		for (std::map<int, CandidateParentSets *>::iterator it = candidates_.begin(); it != candidates_.end(); ++it)
+			delete it->second;
+		delete columns_;
+	}
+
+	int getNumVariables() const
+	{
+		return data_.getNumVariables();
+	}
+
+	const Data &getData() const
+	{
+		return data_;
+	}
+
+	// the local scores of parent sets with at most maxParents elements, created on first use
+	LocalScoreCache &getLocalScores(int maxParents)
+	{
+		maxParents = clampMaxParents(maxParents);
+		std::map<int, LocalScoreCache *>::iterator it = localScores_.find(maxParents);
+		if (it == localScores_.end())
+			it = localScores_.insert(std::make_pair(maxParents, new LocalScoreCache(*columns_, &scoreFun_, maxParents))).first;
+		return *it->second;
+	}
+
+	// the candidates of pruneParentSets, computed on first use
+	const CandidateParentSets &getCandidates(int maxParents)
+	{
+		maxParents = clampMaxParents(maxParents);
+		std::map<int, CandidateParentSets *>::iterator it = candidates_.find(maxParents);
+		if (it == candidates_.end())
+		{
+			CandidateParentSets *candidates = new CandidateParentSets(getNumVariables());
+			pruneParentSets(*columns_, maxParents, &scoreFun_, *candidates);
+			it = candidates_.insert(std::make_pair(maxParents, candidates)).first;
+		}
+		return *it->second;
+	}
+
+	// number of local scores computed by all queries so far
+	size_t getNumComputedScores() const
+	{
+		size_t nComputed = 0;
+		for (std::map<int, LocalScoreCache *>::const_iterator it = localScores_.begin(); it != localScores_.end(); ++it)
+			nComputed += it->second->getNumComputed();
+		return nComputed;
+	}
+
+	// memory taken by the local scores of all bounds
+	size_t getNumBytes() const
+	{
+		size_t nBytes = 0;
+		for (std::map<int, LocalScoreCache *>::const_iterator it = localScores_.begin(); it != localScores_.end(); ++it)
+			nBytes += it->second->getNumBytes();
+		return nBytes;
+	}
+
+	// memory taken by the local scores of one in-degree bound
+	size_t getNumBytes(int maxParents) const
+	{
+		std::map<int, LocalScoreCache *>::const_iterator it = localScores_.find(clampMaxParents(maxParents));
+		return it == localScores_.end() ? 0 : it->second->getNumBytes();
+	}
+
+	/**
+	 * An upper estimate of the memory that a query with at most maxParents
+	 * parents may add while it runs: the rest of the score table of the bound
+	 * and, for findBestDAG (exact), the tables of the search unless the
+	 * optimal order is known already.
+	 */
+	size_t estimateQueryBytes(int maxParents, bool exact)
+	{
+		maxParents = clampMaxParents(maxParents);
+		int n = getNumVariables();
+		size_t table = LocalScoreCache::getTableBytes(n, maxParents);
+		size_t current = getNumBytes(maxParents);
+		size_t nBytes = table > current ? table - current : 0;
+		if (exact && n <= 30 && bestOrders_.count(maxParents) == 0)
+		{
+			size_t nSubsets = (size_t)1 << n;
+			if (maxParents < n - 1 && 4 * SubsetRanker(n, maxParents).getNumSubsets() < nSubsets)
+			{
+				size_t nSets = SubsetRanker(n, maxParents).getNumSubsets();
+				// SparseParentsetMap, SparseBestParents with its index, and findOrder
+				nBytes += (size_t)n * nSets * (2 * sizeof(Real) + sizeof(size_t)) +
+						  (size_t)n * n * ((nSets + 63) / 64) * sizeof(uint64_t) + nSubsets * (sizeof(Real) + sizeof(int));
+			}
+			else
+				nBytes += nSubsets * ((size_t)n * (sizeof(double) + sizeof(uint32_t)) + 2 * sizeof(double) + sizeof(int));
+		}
+		return nBytes;
+	}
+
+	// frees the local scores of the in-degree bounds other than keepMaxParents (-1 frees all)
+	void evictLocalScores(int keepMaxParents)
+	{
+		if (keepMaxParents >= 0)
+			keepMaxParents = clampMaxParents(keepMaxParents);
+		std::map<int, LocalScoreCache *>::iterator it = localScores_.begin();
+		while (it != localScores_.end())
+		{
+			if (it->first == keepMaxParents)
+			{
+				++it;
+				continue;
+			}
+			delete it->second;
+			localScores_.erase(it++);
+		}
+	}
+
+	/**
+	 * Runs a single order chain with the options (see runOrderMCMC); the edge
+	 * posteriors are result.getEdgePosterior(i, j). Tempered runs
+	 * (options.replicas > 1) are not supported.
+	 */
+	void runOrderMCMC(const MCMCOptions &options, OrderMCMCResult &result)
+	{
+		if (options.replicas > 1)
+			throw Exception("Sessions run a single order chain, not %d replicas") % options.replicas;
+		if (result.edgeCounts.getNumNodes() != getNumVariables())
+			throw Exception("The result has %d variables instead of %d") % result.edgeCounts.getNumNodes() % getNumVariables();
+		LocalScoreCache &localScores = getLocalScores(options.maxParentSize);
+		const CandidateParentSets *candidates = options.pruneParents ? &getCandidates(options.maxParentSize) : NULL;
+		::runOrderMCMC(data_, targets_, localScores, candidates, options, result);
+	}
+
+	/**
+	 * Sets dag to the parents of the nodes in order that score best with at
+	 * most maxParents parents, and returns the log score of dag.
+	 */
+	double order2dag(const std::vector<int> &order, int maxParents, BitMatrix &dag)
+	{
+		if ((int)order.size() != getNumVariables() || dag.getNumNodes() != getNumVariables())
+			throw Exception("An order and a DAG of %d variables are needed") % getNumVariables();
+		LocalScoreCache &localScores = getLocalScores(maxParents);
+		std::vector<int> o(order);
+		dag.clearAll();
+		::order2dag(localScores, o, localScores.getMaxParents(), dag);
+		return dagLogScore(localScores, dag);
+	}
+
+	/**
+	 * Finds an optimal DAG with at most maxParents parents per node by the
+	 * exact dynamic programming of findBestDAG, over the scores of the
+	 * session's cache, and returns its log score. Like findBestDAG it uses
+	 * the sparse tables when the bound makes them much smaller than 2^n. The optimal order is kept,
+	 * so asking again for the same bound costs one order2dag.
+	 */
+	double findBestDAG(int maxParents, BitMatrix &dag, std::vector<int> *order = NULL)
+	{
+		int n = getNumVariables();
+		if (n > 30)
+			throw Exception("Exact search is limited to 30 variables, the data has %d") % n;
+		LocalScoreCache &localScores = getLocalScores(maxParents);
+		int k = localScores.getMaxParents();
+		std::map<int, std::vector<int> >::iterator it = bestOrders_.find(k);
+		if (it == bestOrders_.end())
+		{
+			localScores.fill();
+			std::list<int> bestOrder;
+			if (k < n - 1 && 4 * SubsetRanker(n, k).getNumSubsets() < ((size_t)1 << n))
+			{
+				SparseParentsetMap<Real> scores(n, k);
+				computeScores(localScores, scores);
+				SparseBestParents bestPa(scores);
+				findOrder(n, bestPa, bestOrder);
+			}
+			else
+			{
+				ParentsetMap<double> logScores(n);
+				ParentsetMap<uint32_t> bestPa(n);
+				computeLogScores(localScores, logScores);
+				findBestParentsCompact(n, logScores, bestPa);
+				findOrder(n, logScores, bestPa, bestOrder);
+			}
+			it = bestOrders_.insert(std::make_pair(k, std::vector<int>(bestOrder.begin(), bestOrder.end()))).first;
+		}
+		if (order)
+			*order = it->second;
+		return order2dag(it->second, k, dag);
+	}
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+#ifndef SUBSETRANK_HPP
+#define SUBSETRANK_HPP
+
+/**
+ * Ranks the subsets of {0, ..., n-1} with at most maxSize elements.
+ * Subsets are ordered first by size and then colexicographically, so the
+ * subsets of one size occupy a contiguous block and the rank of a sorted
+ * subset {c_0 < c_1 < ... < c_{j-1}} within its block is sum_i C(c_i, i+1).
+ */
+class SubsetRanker
+{
+private:
+	int n_;
+	int maxSize_;
+	std::vector<size_t> binom_;	 // (n+1) x (n+1) table of binomial coefficients
+	std::vector<size_t> offsets_; // offsets_[j] = number of subsets with less than j elements
+
+public:
+	SubsetRanker(int n, int maxSize)
+	{
+		n_ = n;
+		maxSize_ = maxSize < n ? maxSize : n;
+		binom_.assign((n_ + 1) * (n_ + 1), 0);
+		for (int a = 0; a <= n_; ++a)
+		{
+			binom_[a * (n_ + 1)] = 1;
+			for (int b = 1; b <= a; ++b)
+				binom_[a * (n_ + 1) + b] = binom_[(a - 1) * (n_ + 1) + b - 1] + (b < a ? binom_[(a - 1) * (n_ + 1) + b] : 0);
+		}
+		offsets_.resize(maxSize_ + 2);
+		offsets_[0] = 0;
+		for (int j = 0; j <= maxSize_; ++j)
+			offsets_[j + 1] = offsets_[j] + binom(n_, j);
+	}
+
+	int getNumElements() const
+	{
+		return n_;
+	}
+
+	int getMaxSize() const
+	{
+		return maxSize_;
+	}
+
+	size_t binom(int a, int b) const
+	{
+		if (b < 0 || a < 0 || b > a)
+			return 0;
+		return binom_[a * (n_ + 1) + b];
+	}
+
+	// number of subsets with at most maxSize elements
+	size_t getNumSubsets() const
+	{
+		return offsets_[maxSize_ + 1];
+	}
+
+	// first rank of the subsets with the given size
+	size_t getSizeOffset(int size) const
+	{
+		return offsets_[size];
+	}
+
+	// rank of a subset given as an ascending list of elements
+	size_t rank(const int *items, int size) const
+	{
+		assert(size <= maxSize_);
+		size_t r = offsets_[size];
+		for (int i = 0; i < size; ++i)
+		{
+			assert(i == 0 || items[i - 1] < items[i]);
+			r += binom(items[i], i + 1);
+		}
+		return r;
+	}
+
+	// rank of a subset given as a bit mask
+	size_t rankMask(uint64_t mask) const
+	{
+		size_t r = 0;
+		int i = 0;
+		while (mask)
+		{
+			int c = __builtin_ctzll(mask);
+			r += binom(c, ++i);
+			mask &= mask - 1;
+		}
+		assert(i <= maxSize_);
+		return offsets_[i] + r;
+	}
+
+	// inverse of rankMask
+	uint64_t unrankMask(size_t r) const
+	{
+		int size = 0;
+		while (offsets_[size + 1] <= r)
+			++size;
+		r -= offsets_[size];
+		uint64_t mask = 0;
+		for (int i = size; i > 0; --i)
+		{
+			int c = i - 1;
+			while (binom(c + 1, i) <= r)
+				++c;
+			r -= binom(c, i);
+			mask |= (uint64_t)1 << c;
+		}
+		return mask;
+	}
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "common.hpp"
+#include "data.hpp"
+#include "scores.hpp"
+#include "scorecache.hpp"
+#include "pruning.hpp"
+#include "order.hpp"
+#include "timer.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+#ifndef TEMPERING_HPP
+#define TEMPERING_HPP
+
+// blocks each of nThreads callers of wait() until all of them have called it
+class ThreadBarrier
+{
+private:
+	std::mutex mutex_;
+	std::condition_variable cond_;
+	int nThreads_;
+	int nWaiting_;
+	uint64_t generation_;
+
+public:
+	ThreadBarrier(int nThreads) : nThreads_(nThreads), nWaiting_(0), generation_(0) {}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		uint64_t generation = generation_;
+		if (++nWaiting_ == nThreads_)
+		{
+			nWaiting_ = 0;
+			++generation_;
+			cond_.notify_all();
+		}
+		else
+			cond_.wait(lock, [this, generation] { return generation_ != generation; });
+	}
+};
+
+// one chain of parallel tempering, run by its own thread at inverse temperature beta
+struct Replica
+{
+	OrderChain chain;
+	OrderChain proposal;
+	double x; // log score of chain
+	double beta;
+	std::mt19937 gen;
+	uint64_t proposed;
+	uint64_t accepted;
+};
+
+/**
+ * Order MCMC with replica exchange. options.replicas chains run on their
+ * own threads at inverse temperatures 1 = beta_0 > beta_1 > ..., accepting
+ * a proposal of log score y from x if log u < beta (y - x) plus the
+ * Hastings term of the move. Every swapInterval iterations the threads
+ * meet and neighbouring chains a and b exchange their states if
+ * log u < (beta_a - beta_b) (x_b - x_a). During the first half of the run
+ * the gaps of the ladder follow the swap rates, T_{k+1} - T_k = exp(S_k)
+ * with S_k moved towards a swap rate of 0.234 by a decaying gain; the
+ * ladder is fixed afterwards.
+ * Samples come from the cold chain only. The local score cache is filled
+ * up front, by all threads, and then shared read-only.
+ */
+void temperedMCMC(Data &data, vector<int> &targets, const MCMCOptions &options)
+{
+	Timer timer;
+	metrics.reset();
+	double equivalentSampleSize = 1;
+	int n = targets.size();
+	int nReplicas = options.replicas;
+	int maxParentSize = options.maxParentSize;
+	int burn_in = options.burnIn;
+	BDeuScore scoreFun(equivalentSampleSize);
+	std::mt19937 gen(options.seed);
+	if (options.seed == 0)
+	{
+		random_device rd;
+		gen.seed(rd());
+	}
+	DataColumns datacolumns(data, targets);
+	LocalScoreCache localScores(datacolumns, &scoreFun, maxParentSize);
+	if (!options.scoreStore.empty())
+		attachScoreStore(localScores, data, targets, options.scoreStore, equivalentSampleSize);
+	{
+		TraceSpan span("fill_scores");
+		localScores.fill(nReplicas);
+	}
+	CandidateParentSets candidates(n);
+	if (options.pruneParents)
+	{
+		PruningStats pruningStats;
+		pruneParentSets(datacolumns, maxParentSize, &scoreFun, candidates, &pruningStats);
+		printPruningStats(cout, pruningStats);
+	}
+
+	// initial ladder T_k = 1.5^k
+	vector<double> logGaps(nReplicas > 1 ? nReplicas - 1 : 0);
+	for (size_t k = 0; k < logGaps.size(); ++k)
+		logGaps[k] = log(0.5) + k * log(1.5);
+	vector<Replica> replicas(nReplicas);
+	for (int k = 0; k < nReplicas; ++k)
+	{
+		Replica &r = replicas[k];
+		r.chain.order = targets;
+		rescoreOrder(localScores, r.chain, 0, n - 1, maxParentSize);
+		r.proposal = r.chain;
+		r.x = r.chain.score;
+		r.gen.seed(gen());
+		r.proposed = 0;
+		r.accepted = 0;
+	}
+	double temperature = 1;
+	for (int k = 0; k < nReplicas; ++k)
+	{
+		replicas[k].beta = 1 / temperature;
+		if (k + 1 < nReplicas)
+			temperature += exp(logGaps[k]);
+	}
+
+	SquareMat<int> res(n);
+	BitMatrix dag(n);
+	res.setAll(0);
+	int sample_count = 0;
+	vector<uint64_t> swapTries(logGaps.size(), 0), swapAccepts(logGaps.size(), 0);
+	int nRounds = (burn_in + options.swapInterval - 1) / options.swapInterval;
+	ThreadBarrier barrier(nReplicas);
+	SampleSink *sampleSink = NULL;
+	if (!options.samplesFile.empty())
+		sampleSink = new SampleSink(options.samplesFile, n);
+	std::uniform_real_distribution<double> dis(0.0, 1.0);
+	timer.start();
+
+	auto runReplica = [&](int k) {
+		Replica &r = replicas[k];
+		OrderProposer proposer(data, localScores, &scoreFun, options);
+		std::uniform_real_distribution<double> acceptDis(0.0, 1.0);
+		int temp = burn_in;
+		for (int round = 0; round < nRounds; ++round)
+		{
+			for (int it = 0; it < options.swapInterval && temp > 0; ++it)
+			{
+				--temp;
+				TraceSpan span("mcmc_iteration");
+				int move;
+				double logHastings;
+				double y = proposer.propose(r.chain, r.proposal, move, logHastings, r.gen);
+				bool accept = log(acceptDis(r.gen)) < r.beta * (y - r.x) + logHastings;
+				++r.proposed;
+				if (accept)
+				{
+					++r.accepted;
+					r.chain.order.swap(r.proposal.order);
+					r.chain.nodeScores.swap(r.proposal.nodeScores);
+					r.chain.score = r.proposal.score;
+					r.x = y;
+				}
+				if (k == 0)
+				{
+					metrics.countIteration(true, accept);
+					metrics.setCurrentScore(r.x);
+					if (temp % 10 == 0)
+					{
+						sample_count++;
+						dag.clearAll();
+						if (options.pruneParents)
+							order2dag(candidates, r.chain.order, dag);
+						else
+							order2dag(localScores, r.chain.order, maxParentSize, dag);
+						dag.addTo(res);
+						if (sampleSink)
+							sampleSink->push(r.chain.order, dag, dagLogScore(localScores, dag));
+					}
+				}
+			}
+			barrier.wait();
+			if (k == 0)
+			{
+				TraceSpan span("replica_swap");
+				for (int j = 0; j + 1 < nReplicas; ++j)
+				{
+					Replica &a = replicas[j], &b = replicas[j + 1];
+					bool swapped = log(dis(gen)) < (a.beta - b.beta) * (b.x - a.x);
+					++swapTries[j];
+					if (swapped)
+					{
+						++swapAccepts[j];
+						std::swap(a.chain, b.chain);
+						std::swap(a.x, b.x);
+					}
+					if (round < nRounds / 2)
+						logGaps[j] += ((swapped ? 1.0 : 0.0) - 0.234) / pow(1.0 + round, 0.6);
+				}
+				if (round < nRounds / 2)
+				{
+					double t = 1;
+					for (int j = 0; j < nReplicas; ++j)
+					{
+						replicas[j].beta = 1 / t;
+						if (j + 1 < nReplicas)
+							t += exp(logGaps[j]);
+					}
+				}
+			}
+			barrier.wait();
+		}
+	};
+	vector<std::thread> threads;
+	for (int k = 1; k < nReplicas; ++k)
+		threads.push_back(std::thread(runReplica, k));
+	runReplica(0);
+	for (size_t k = 0; k < threads.size(); ++k)
+		threads[k].join();
+
+	for (int k = 0; k < nReplicas; ++k)
+	{
+		cout << "replica " << k << ": temperature " << 1 / replicas[k].beta << ", moves " << replicas[k].accepted << " of "
+			 << replicas[k].proposed << " accepted";
+		if (k + 1 < nReplicas)
+			cout << ", swaps with " << k + 1 << ": " << swapAccepts[k] << " of " << swapTries[k];
+		cout << endl;
+	}
+	if (sampleSink)
+	{
+		reportSampleSink(*sampleSink);
+		delete sampleSink;
+	}
+	metrics.setCacheStats(localScores.getNumHits(), localScores.getNumComputed());
+	if (!options.metricsFile.empty())
+	{
+		ofstream metricsOut(options.metricsFile.c_str(), ios::out | ios::trunc);
+		metricsOut << metrics.toJson() << endl;
+	}
+	cout << "sample count: " << sample_count << endl;
+	cout << "time elapsed: " << timer.elapsed() << endl;
+	writeEdgeFrequencies("result.dat", res, sample_count);
+	if (!localScores.save())
+		cout << "could not write score store " << localScores.getStore()->getPath() << endl;
+}
+
+#endif
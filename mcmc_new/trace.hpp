@@ -0,0 +1,157 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+struct TraceEvent
+{
+	const char *name; // must outlive the tracer, normally a string literal
+	uint64_t startNs; // wall-clock start relative to the tracer epoch
+	uint64_t durNs;	  // wall-clock duration
+	uint64_t cpuNs;	  // CPU time of the recording thread during the span
+};
+
+struct TraceBuffer
+{
+	int tid;
+	std::vector<TraceEvent> events;
+};
+
+/**
+ * Collects timed spans into per-thread buffers and writes them as a
+ * Chrome trace-event file (chrome://tracing, Perfetto). Recording only
+ * appends to the calling thread's own buffer; the lock is taken once per
+ * thread, when its buffer is created.
+ */
+class Tracer
+{
+private:
+	std::atomic<bool> enabled_;
+	std::mutex mutex_;
+	std::vector<TraceBuffer *> buffers_;
+	std::chrono::steady_clock::time_point epoch_;
+
+	Tracer(const Tracer &);			   // disable copying
+	Tracer &operator=(const Tracer &); // disable copying
+
+public:
+	Tracer() : enabled_(false), epoch_(std::chrono::steady_clock::now()) {}
+
+	~Tracer()
+	{
+		for (size_t i = 0; i < buffers_.size(); ++i)
+			delete buffers_[i];
+	}
+
+	void enable()
+	{
+		epoch_ = std::chrono::steady_clock::now();
+		enabled_ = true;
+	}
+
+	bool isEnabled() const
+	{
+		return enabled_.load(std::memory_order_relaxed);
+	}
+
+	uint64_t now() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch_).count();
+	}
+
+	static uint64_t threadCpuNow()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	TraceBuffer *getThreadBuffer()
+	{
+		static thread_local TraceBuffer *buffer = NULL;
+		if (buffer == NULL)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			buffer = new TraceBuffer();
+			buffer->tid = buffers_.size() + 1;
+			buffer->events.reserve(1024);
+			buffers_.push_back(buffer);
+		}
+		return buffer;
+	}
+
+	// writes all recorded spans, returns false if the file could not be written
+	bool writeChromeTrace(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		FILE *f = fopen(path.c_str(), "w");
+		if (f == NULL)
+			return false;
+		fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+		bool first = true;
+		for (size_t b = 0; b < buffers_.size(); ++b)
+		{
+			const TraceBuffer *buffer = buffers_[b];
+			fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+					first ? "" : ",\n", buffer->tid, buffer->tid == 1 ? "main" : "worker", buffer->tid);
+			first = false;
+			for (size_t i = 0; i < buffer->events.size(); ++i)
+			{
+				const TraceEvent &e = buffer->events[i];
+				fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"cpu_ms\": %.6f}}",
+						e.name, buffer->tid, e.startNs * 1e-3, e.durNs * 1e-3, e.cpuNs * 1e-6);
+			}
+		}
+		fprintf(f, "\n]}\n");
+		return fclose(f) == 0;
+	}
+};
+
+Tracer tracer;
+
+/**
+ * Records the wall-clock and thread CPU time of its lifetime as one span
+ * when tracing is enabled; costs a single flag test otherwise.
+ */
+class TraceSpan
+{
+private:
+	const char *name_;
+	uint64_t start_;
+	uint64_t cpuStart_;
+	bool active_;
+
+	TraceSpan(const TraceSpan &);			 // disable copying
+	TraceSpan &operator=(const TraceSpan &); // disable copying
+
+public:
+	TraceSpan(const char *name) : name_(name), active_(tracer.isEnabled())
+	{
+		if (active_)
+		{
+			start_ = tracer.now();
+			cpuStart_ = Tracer::threadCpuNow();
+		}
+	}
+
+	~TraceSpan()
+	{
+		if (!active_)
+			return;
+		TraceEvent e;
+		e.name = name_;
+		e.startNs = start_;
+		e.durNs = tracer.now() - start_;
+		e.cpuNs = Tracer::threadCpuNow() - cpuStart_;
+		tracer.getThreadBuffer()->events.push_back(e);
+	}
+};
+
+#endif